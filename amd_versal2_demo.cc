@@ -250,5 +250,5 @@ int sc_main(int argc, char* argv[])
 	if (trace_fp) {
 		sc_close_vcd_trace_file(trace_fp);
 	}
-	return 0;
+	return debugdev::exit_status();
 }
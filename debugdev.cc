@@ -26,6 +26,15 @@
 #define SC_INCLUDE_DYNAMIC_PROCESSES
 
 #include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "tlm_utils/simple_initiator_socket.h"
 #include "tlm_utils/simple_target_socket.h"
@@ -36,12 +45,386 @@ using namespace std;
 #include "debugdev.h"
 #include <sys/types.h>
 #include <time.h>
+#include <math.h>
+
+/*
+ * Console output buffering. The simulation appends to a line buffer that is
+ * queued for a host thread doing the actual (possibly slow) writes on
+ * newline or when the buffer is full.
+ */
+class debugdev_console
+{
+public:
+	debugdev_console(FILE *fp)
+		: fp(fp), stop(false), busy(false)
+	{
+		thread = std::thread(&debugdev_console::writer_thread, this);
+	}
+
+	~debugdev_console()
+	{
+		flush();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = true;
+		}
+		cond.notify_all();
+		thread.join();
+	}
+
+	void write(const char *data, size_t len)
+	{
+		size_t i;
+
+		for (i = 0; i < len; i++) {
+			line += data[i];
+			if (data[i] == '\n' || line.size() >= LINE_MAX_LEN) {
+				queue_line();
+			}
+		}
+	}
+
+	/* Queue any partial line and wait until everything is written.  */
+	void flush(void)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+
+		if (!line.empty()) {
+			queue.push_back(line);
+			line.clear();
+			cond.notify_all();
+		}
+		while (!queue.empty() || busy) {
+			cond.wait(guard);
+		}
+	}
+
+private:
+	enum { LINE_MAX_LEN = 4096 };
+
+	void queue_line(void)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			queue.push_back(line);
+		}
+		line.clear();
+		cond.notify_all();
+	}
+
+	void writer_thread(void)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+
+		while (true) {
+			std::vector<std::string> lines;
+			size_t i;
+
+			while (queue.empty() && !stop) {
+				cond.wait(guard);
+			}
+			if (queue.empty()) {
+				break;
+			}
+
+			lines.swap(queue);
+			busy = true;
+			guard.unlock();
+
+			for (i = 0; i < lines.size(); i++) {
+				fwrite(lines[i].data(), 1, lines[i].size(), fp);
+			}
+			fflush(fp);
+
+			guard.lock();
+			busy = false;
+			cond.notify_all();
+		}
+	}
+
+	FILE *fp;
+	/* Only accessed by the simulation.  */
+	std::string line;
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::vector<std::string> queue;
+	bool stop;
+	bool busy;
+	std::thread thread;
+};
+
+/*
+ * Guest profiling regions. Every closed region records its duration, and
+ * its self time (excluding nested regions), under its marker ID.
+ */
+class debugdev_profiler
+{
+public:
+	debugdev_profiler() : name_id(0), nr_dropped(0) {}
+
+	void begin(uint32_t id, sc_time now)
+	{
+		region r;
+
+		r.id = id;
+		r.start = now;
+		r.children = SC_ZERO_TIME;
+		stack.push_back(r);
+	}
+
+	void end(uint32_t id, sc_time now)
+	{
+		size_t i = stack.size();
+		sc_time t;
+
+		/* Find the innermost open region of the marker.  */
+		while (i > 0 && stack[i - 1].id != id) {
+			i--;
+		}
+		if (i == 0) {
+			nr_dropped++;
+			return;
+		}
+
+		/* Regions nested in it that were left open are dropped.  */
+		nr_dropped += stack.size() - i;
+		stack.resize(i);
+
+		t = now - stack.back().start;
+		marker &m = markers[id];
+		m.times.push_back(t);
+		m.self += t - stack.back().children;
+		stack.pop_back();
+
+		if (!stack.empty()) {
+			stack.back().children += t;
+		}
+	}
+
+	void select_name(uint32_t id)
+	{
+		name_id = id;
+		markers[id].name.clear();
+	}
+
+	void append_name(const unsigned char *data, unsigned int len)
+	{
+		unsigned int i;
+
+		for (i = 0; i < len; i++) {
+			if (data[i]) {
+				markers[name_id].name += data[i];
+			}
+		}
+	}
+
+	std::string report(const char *devname)
+	{
+		std::map<uint32_t, marker>::iterator it;
+		std::ostringstream o;
+
+		if (markers.empty()) {
+			return "";
+		}
+
+		o << devname << ": profile (simulated time)\n";
+		for (it = markers.begin(); it != markers.end(); it++) {
+			std::vector<sc_time> &t = it->second.times;
+			sc_time total = SC_ZERO_TIME;
+			size_t i;
+
+			o << "  0x" << hex << it->first << dec;
+			if (!it->second.name.empty()) {
+				o << " " << it->second.name;
+			}
+			o << ": count=" << t.size();
+			if (t.empty()) {
+				o << "\n";
+				continue;
+			}
+
+			std::sort(t.begin(), t.end());
+			for (i = 0; i < t.size(); i++) {
+				total += t[i];
+			}
+			o << " total=" << total
+			  << " self=" << it->second.self
+			  << " min=" << t.front()
+			  << " p50=" << percentile(t, 50)
+			  << " p90=" << percentile(t, 90)
+			  << " p99=" << percentile(t, 99)
+			  << " max=" << t.back() << "\n";
+		}
+		if (nr_dropped || !stack.empty()) {
+			o << "  unbalanced: " << nr_dropped << " dropped, "
+			  << stack.size() << " still open\n";
+		}
+		return o.str();
+	}
+
+private:
+	struct marker {
+		marker() : self(SC_ZERO_TIME) {}
+
+		std::string name;
+		std::vector<sc_time> times;
+		sc_time self;
+	};
+
+	struct region {
+		uint32_t id;
+		sc_time start;
+		/* Time spent in closed nested regions.  */
+		sc_time children;
+	};
+
+	/* Nearest rank percentile of sorted times.  */
+	static sc_time percentile(const std::vector<sc_time> &t, unsigned int p)
+	{
+		size_t rank = (t.size() * p + 99) / 100;
+
+		return t[rank ? rank - 1 : 0];
+	}
+
+	std::map<uint32_t, marker> markers;
+	std::vector<region> stack;
+	uint32_t name_id;
+	uint64_t nr_dropped;
+};
 
 debugdev::debugdev(sc_module_name name)
-	: sc_module(name), socket("socket")
+	: sc_module(name), socket("socket"), dma_socket("dma-socket"),
+	  irq_val(0), console(new debugdev_console(stdout)),
+	  ring_base(0), ring_size(0), ring_head(0), ring_tail(0),
+	  last_ts(SC_ZERO_TIME), prof(new debugdev_profiler()),
+	  shadow_active(false), host_start_ns(0), perf_speed(0)
 {
 	socket.register_b_transport(this, &debugdev::b_transport);
 	socket.register_transport_dbg(this, &debugdev::transport_dbg);
+	socket.register_get_direct_mem_ptr(this, &debugdev::get_direct_mem_ptr);
+
+	SC_METHOD(update_irqs);
+	dont_initialize();
+	sensitive << ev_update_irqs;
+
+	SC_THREAD(ring_thread);
+
+	perf_cur.host_ns = 0;
+	perf_cur.sim = SC_ZERO_TIME;
+	perf_cur.deltas = 0;
+	perf_prev = perf_cur;
+
+	SC_METHOD(refresh_shadow);
+	dont_initialize();
+	sensitive << ev_shadow;
+}
+
+debugdev::~debugdev()
+{
+	delete prof;
+	delete console;
+}
+
+void debugdev::start_of_simulation()
+{
+	host_start_ns = host_ns();
+}
+
+void debugdev::end_of_simulation()
+{
+	std::string r = prof->report(name());
+	std::ostringstream o;
+	double sim = sc_time_stamp().to_seconds();
+	double host = (host_ns() - host_start_ns) / 1e9;
+
+	o << name() << ": simulated " << sc_time_stamp()
+	  << " in " << host << " s host time (sim/host "
+	  << (host > 0 ? sim / host : 0) << "), "
+	  << sc_delta_count() << " delta cycles\n";
+	r += o.str();
+
+	console->write(r.data(), r.size());
+	console->flush();
+}
+
+uint64_t debugdev::host_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void debugdev::perf_take_sample(sc_time now)
+{
+	double sim, host;
+
+	perf_prev = perf_cur;
+	perf_cur.host_ns = host_ns() - host_start_ns;
+	perf_cur.sim = now;
+	perf_cur.deltas = sc_delta_count();
+
+	sim = (perf_cur.sim - perf_prev.sim).to_seconds();
+	host = (perf_cur.host_ns - perf_prev.host_ns) / 1e9;
+	if (host <= 0 || sim / host >= 0xffffffffULL / 1e6) {
+		perf_speed = host <= 0 && sim <= 0 ? 0 : 0xffffffff;
+	} else {
+		perf_speed = llround(sim / host * 1e6);
+	}
+}
+
+/*
+ * Fetch the log ring contents up to the head. The DMA runs in its own
+ * thread and its delays are not waited for, the guest is not held up.
+ */
+void debugdev::ring_thread(void)
+{
+	char buf[256];
+
+	while (true) {
+		wait(ev_ring);
+
+		while (ring_tail != ring_head) {
+			tlm::tlm_generic_payload tr;
+			sc_time delay = SC_ZERO_TIME;
+			uint32_t off = ring_tail & (ring_size - 1);
+			uint32_t len = ring_head - ring_tail;
+
+			if (len > ring_size - off) {
+				len = ring_size - off;
+			}
+			if (len > sizeof buf) {
+				len = sizeof buf;
+			}
+
+			tr.set_command(tlm::TLM_READ_COMMAND);
+			tr.set_address(ring_base + off);
+			tr.set_data_ptr((unsigned char *) buf);
+			tr.set_data_length(len);
+			tr.set_streaming_width(len);
+			tr.set_dmi_allowed(false);
+			tr.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+
+			dma_socket->b_transport(tr, delay);
+			if (tr.get_response_status() != tlm::TLM_OK_RESPONSE) {
+				printf("%s:%d log ring DMA error!\n",
+					__func__, __LINE__);
+				ring_tail = ring_head;
+				break;
+			}
+
+			console->write(buf, len);
+			ring_tail += len;
+		}
+		update_shadow();
+	}
+}
+
+void debugdev::update_irqs(void)
+{
+	irq[0].write(irq_val & 1);
+	irq[1].write((irq_val & 2) >> 1);
 }
 
 void debugdev::b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
@@ -58,11 +441,41 @@ void debugdev::b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
 		return;
 	}
 
-	if (len > 4 || wid < len) {
+	/* Only console FIFO and marker name writes may carry more than a word.  */
+	if ((len > 4 && !((addr == DEBUGDEV_R_CONSOLE_FIFO ||
+			   addr == DEBUGDEV_R_PROF_NAME) && len <= 8 &&
+			  cmd == tlm::TLM_WRITE_COMMAND)) || wid < len) {
 		trans.set_response_status(tlm::TLM_BURST_ERROR_RESPONSE);
 		return;
 	}
 	trans.set_response_status(tlm::TLM_OK_RESPONSE);
+	trans.set_dmi_allowed(cmd == tlm::TLM_READ_COMMAND &&
+				addr < sizeof shadow);
+
+	if (addr >= DEBUGDEV_R_CONSOLE_FIFO && addr <= DEBUGDEV_R_RING_TAIL) {
+		console_access(trans);
+		return;
+	}
+
+	if (addr >= DEBUGDEV_R_PROF_BEGIN && addr <= DEBUGDEV_R_PROF_NAME) {
+		prof_access(trans, sc_time_stamp() + delay);
+		return;
+	}
+
+	/* The performance counters take no simulated time either.  */
+	if (addr >= DEBUGDEV_R_PERF_SAMPLE && addr <= DEBUGDEV_R_PERF_DELTAS) {
+		uint32_t v = 0;
+
+		if (cmd == tlm::TLM_WRITE_COMMAND &&
+			addr == DEBUGDEV_R_PERF_SAMPLE) {
+			perf_take_sample(sc_time_stamp() + delay);
+			update_shadow();
+		} else if (cmd == tlm::TLM_READ_COMMAND) {
+			v = read_reg(addr, sc_time_stamp() + delay);
+			memcpy(data, &v, len);
+		}
+		return;
+	}
 
 	// Pretend this is slow!
 	delay += sc_time(1, SC_US);
@@ -71,18 +484,8 @@ void debugdev::b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
 		sc_time now = sc_time_stamp() + delay;
 		uint32_t v = 0;
 
+		v = read_reg(addr, now);
 		switch (addr) {
-			case 0:
-//				cout << "read " << addr << " " << t << endl;
-				v = now.to_seconds() * 1000 * 1000 * 1000;
-				break;
-			case 0xc:
-				v = irq[0].read();
-				v |= irq[1].read() << 1;
-				break;
-			case 0x10:
-				v = clock();
-				break;
 			case 0xf0:
 				trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
 				break;
@@ -94,29 +497,32 @@ void debugdev::b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
 		}
 		memcpy(data, &v, len);
 	} else if (cmd == tlm::TLM_WRITE_COMMAND) {
-		static sc_time old_ts = SC_ZERO_TIME, now, diff;
+		sc_time now = sc_time_stamp() + delay;
+		sc_time diff = now - last_ts;
 
-		now = sc_time_stamp() + delay;
-		diff = now - old_ts;
 		switch (addr) {
-			case 0:
-				cout << "TRACE: " << " "
-				     << hex << * (uint32_t *) data
-				     << " " << now << " diff=" << diff << "\n";
+			case 0: {
+				std::ostringstream msg;
+
+				msg << "TRACE: " << " "
+				    << hex << * (uint32_t *) data
+				    << " " << now << " diff=" << diff << "\n";
+				console->write(msg.str().data(), msg.str().size());
 				break;
-			case 0x4:
-				putchar(* (uint32_t *) data);
+			}
+			case 0x4: {
+				char c = * (uint32_t *) data;
+
+				console->write(&c, 1);
 				break;
+			}
 			case 0x8:
-				cout << "STOP: " << " "
-				     << hex << * (uint32_t *) data
-				     << " " << now << "\n";
-				sc_stop();
-				exit(1);
+				stop(* (uint32_t *) data, now);
 				break;
 			case 0xc:
-				irq[0].write(data[0] & 1);
-				irq[1].write((data[0] & 2) >> 1);
+				irq_val = data[0] & 3;
+				ev_update_irqs.notify(delay);
+				update_shadow();
 				break;
 			case 0xf0:
 				trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
@@ -127,17 +533,307 @@ void debugdev::b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
 			default:
 				break;
 		}
-		old_ts = now;
+		last_ts = now;
+	}
+}
+
+/* The console and log ring registers, these take no simulated time.  */
+void debugdev::console_access(tlm::tlm_generic_payload& trans)
+{
+	sc_dt::uint64 addr = trans.get_address();
+	unsigned char *data = trans.get_data_ptr();
+	unsigned int len = trans.get_data_length();
+	uint32_t v = 0;
+	unsigned int i;
+
+	if (trans.get_command() == tlm::TLM_READ_COMMAND) {
+		v = read_reg(addr, sc_time_stamp());
+		memcpy(data, &v, len);
+		return;
+	}
+
+	if (trans.get_command() != tlm::TLM_WRITE_COMMAND) {
+		return;
+	}
+
+	if (addr == DEBUGDEV_R_CONSOLE_FIFO) {
+		for (i = 0; i < len; i++) {
+			if (data[i]) {
+				console->write((char *) &data[i], 1);
+			}
+		}
+		return;
+	}
+
+	memcpy(&v, data, len);
+	switch (addr) {
+		case DEBUGDEV_R_RING_BASE_LO:
+			ring_base = (ring_base & ~0xffffffffULL) | v;
+			break;
+		case DEBUGDEV_R_RING_BASE_HI:
+			ring_base = (ring_base & 0xffffffffULL) |
+				((uint64_t) v << 32);
+			break;
+		case DEBUGDEV_R_RING_SIZE:
+			ring_size = v;
+			ring_head = ring_tail = 0;
+			break;
+		case DEBUGDEV_R_RING_HEAD:
+			ring_head = v;
+			/* Drop the update if there is no usable ring.  */
+			if (dma_socket.size() == 0 || ring_size == 0 ||
+				(ring_size & (ring_size - 1)) ||
+				ring_head - ring_tail > ring_size) {
+				ring_tail = ring_head;
+				break;
+			}
+			ev_ring.notify();
+			break;
+		default:
+			break;
+	}
+	update_shadow();
+}
+
+/* The profiling registers, write only, these take no simulated time.  */
+void debugdev::prof_access(tlm::tlm_generic_payload& trans, sc_time now)
+{
+	sc_dt::uint64 addr = trans.get_address();
+	unsigned char *data = trans.get_data_ptr();
+	unsigned int len = trans.get_data_length();
+	uint32_t v = 0;
+
+	if (trans.get_command() == tlm::TLM_READ_COMMAND) {
+		memset(data, 0, len);
+		return;
+	}
+
+	if (trans.get_command() != tlm::TLM_WRITE_COMMAND) {
+		return;
+	}
+
+	if (addr == DEBUGDEV_R_PROF_NAME) {
+		prof->append_name(data, len);
+		return;
+	}
+
+	memcpy(&v, data, len);
+	switch (addr) {
+		case DEBUGDEV_R_PROF_BEGIN:
+			prof->begin(v, now);
+			break;
+		case DEBUGDEV_R_PROF_END:
+			prof->end(v, now);
+			break;
+		case DEBUGDEV_R_PROF_NAME_ID:
+			prof->select_name(v);
+			break;
+		default:
+			break;
+	}
+}
+
+/* The value of a readable register, without side effects.  */
+uint32_t debugdev::read_reg(sc_dt::uint64 addr, sc_time now)
+{
+	switch (addr) {
+		case DEBUGDEV_R_TRACE:
+			return now.to_seconds() * 1000 * 1000 * 1000;
+		case DEBUGDEV_R_IRQ:
+			return irq_val;
+		case DEBUGDEV_R_CLOCK:
+			return clock();
+		case DEBUGDEV_R_RING_BASE_LO:
+			return ring_base;
+		case DEBUGDEV_R_RING_BASE_HI:
+			return ring_base >> 32;
+		case DEBUGDEV_R_RING_SIZE:
+			return ring_size;
+		case DEBUGDEV_R_RING_HEAD:
+			return ring_head;
+		case DEBUGDEV_R_RING_TAIL:
+			return ring_tail;
+		case DEBUGDEV_R_PERF_HOST_NS_LO:
+			return perf_cur.host_ns;
+		case DEBUGDEV_R_PERF_HOST_NS_HI:
+			return perf_cur.host_ns >> 32;
+		case DEBUGDEV_R_PERF_SPEED:
+			return perf_speed;
+		case DEBUGDEV_R_PERF_DELTAS:
+			return perf_cur.deltas;
+		default:
+			return 0;
+	}
+}
+
+bool debugdev::stopped = false;
+int debugdev::stop_status = 0;
+
+int debugdev::exit_status(void)
+{
+	return stop_status;
+}
+
+void debugdev::stop(uint32_t v, sc_time now)
+{
+	std::ostringstream msg;
+
+	msg << "STOP: " << " " << hex << v << " " << now << "\n";
+	console->write(msg.str().data(), msg.str().size());
+
+	if (v & DEBUGDEV_STOP_SNAPSHOT) {
+		write_snapshot(now);
 	}
 
+	if (!stopped) {
+		stopped = true;
+		stop_status = v & DEBUGDEV_STOP_STATUS_MASK;
+		sc_stop();
+	}
+}
+
+void debugdev::write_snapshot(sc_time now)
+{
+	std::string fname = std::string(name()) + ".snapshot";
+	std::string r = prof->report(name());
+	FILE *fp;
+	unsigned int i;
+
+	fp = fopen(fname.c_str(), "w");
+	if (!fp) {
+		perror(fname.c_str());
+		return;
+	}
+
+	fprintf(fp, "time: %s\n", now.to_string().c_str());
+	fprintf(fp, "delta-cycles: %" PRIu64 "\n",
+		(uint64_t) sc_delta_count());
+	fprintf(fp, "host-ns: %" PRIu64 "\n", host_ns() - host_start_ns);
+	for (i = 0; i < DEBUGDEV_SHADOW_SIZE; i += 4) {
+		fprintf(fp, "reg[0x%02x]: 0x%08x\n", i, read_reg(i, now));
+	}
+	fputs(r.c_str(), fp);
+	fclose(fp);
 }
 
+/*
+ * Debug accesses, of any size and alignment, over the register file.
+ * Reads return the register values at the current kernel time. Writes
+ * only update the IRQ and log ring setup registers, the ones with
+ * console, profiling or stop side effects are ignored.
+ */
 unsigned int debugdev::transport_dbg(tlm::tlm_generic_payload& trans)
 {
+	tlm::tlm_command cmd = trans.get_command();
+	sc_dt::uint64 addr = trans.get_address();
+	unsigned char *data = trans.get_data_ptr();
 	unsigned int len = trans.get_data_length();
+	sc_time now = sc_time_stamp();
+	uint32_t v = 0;
+	unsigned int i;
+
+	if (cmd == tlm::TLM_READ_COMMAND) {
+		for (i = 0; i < len; i++) {
+			sc_dt::uint64 a = addr + i;
+
+			if (i == 0 || (a & 3) == 0) {
+				v = read_reg(a & ~3ULL, now);
+			}
+			data[i] = v >> ((a & 3) * 8);
+		}
+		return len;
+	}
+
+	if (cmd != tlm::TLM_WRITE_COMMAND) {
+		return 0;
+	}
+
+	for (i = 0; i < len; i++) {
+		sc_dt::uint64 a = addr + i;
+		unsigned int shift = (a & 3) * 8;
+		uint32_t mask = 0xff << shift;
+		uint32_t b = (uint32_t) data[i] << shift;
+
+		switch (a & ~3ULL) {
+			case DEBUGDEV_R_IRQ:
+				irq_val = ((irq_val & ~mask) | b) & 3;
+				ev_update_irqs.notify(SC_ZERO_TIME);
+				break;
+			case DEBUGDEV_R_RING_BASE_LO:
+				ring_base = (ring_base & ~(uint64_t) mask) | b;
+				break;
+			case DEBUGDEV_R_RING_BASE_HI:
+				ring_base = (ring_base & ~((uint64_t) mask << 32)) |
+					((uint64_t) b << 32);
+				break;
+			case DEBUGDEV_R_RING_SIZE:
+				ring_size = (ring_size & ~mask) | b;
+				ring_head = ring_tail = 0;
+				break;
+			default:
+				break;
+		}
+	}
+	update_shadow();
 	return len;
 }
 
+/*
+ * Read only DMI to the shadow register page. The page holds the readable
+ * registers and, once DMI is in use, is refreshed after the writes that
+ * change them and once per global quantum, so the time register reads
+ * with quantum granularity (as seen by a temporally decoupled initiator
+ * anyway).
+ */
+bool debugdev::get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+				tlm::tlm_dmi& dmi_data)
+{
+	if (trans.get_command() != tlm::TLM_READ_COMMAND ||
+		trans.get_address() >= sizeof shadow) {
+		return false;
+	}
+
+	if (!shadow_active) {
+		shadow_active = true;
+		ev_shadow.notify(SC_ZERO_TIME);
+	}
+	update_shadow();
+
+	dmi_data.set_dmi_ptr(reinterpret_cast<unsigned char *>(shadow));
+	dmi_data.set_start_address(0);
+	dmi_data.set_end_address(sizeof shadow - 1);
+	dmi_data.allow_read();
+	dmi_data.set_read_latency(SC_ZERO_TIME);
+	return true;
+}
+
+/* Nobody reads the shadow page before DMI to it was handed out.  */
+void debugdev::update_shadow(void)
+{
+	sc_time now = sc_time_stamp();
+	unsigned int i;
+
+	if (!shadow_active) {
+		return;
+	}
+
+	for (i = 0; i < sizeof shadow / sizeof shadow[0]; i++) {
+		shadow[i] = read_reg(i * 4, now);
+	}
+}
+
+void debugdev::refresh_shadow(void)
+{
+	sc_time period = tlm::tlm_global_quantum::instance().get();
+
+	if (period == SC_ZERO_TIME) {
+		period = sc_time(1, SC_US);
+	}
+
+	update_shadow();
+	next_trigger(period);
+}
+
 void debugdev::before_end_of_elaboration()
 {
 	for (int i = 0; i < NUM_DBG_IRQ; i++) {
@@ -23,20 +23,168 @@
 
 #define NUM_DBG_IRQ 2
 
+/*
+ * Register map (offsets into the device):
+ *
+ * 0x00 TRACE (W) / time in ns (R)
+ * 0x04 PUTCHAR (W)
+ * 0x08 STOP (W): stop the simulation. Bits 7:0 are the exit status
+ *      returned by sc_main (see debugdev::exit_status()), bit 8 requests
+ *      a snapshot of the device state in <name>.snapshot first. The
+ *      end of simulation reports and trace files are flushed as usual.
+ * 0x0c IRQ (R/W)
+ * 0x10 host clock() (R)
+ * 0x14 CONSOLE_FIFO (W): 1 to 8 bytes of console output per access, NUL
+ *      bytes are skipped (to pad the last word of a string).
+ * 0x18 RING_BASE_LO (R/W)
+ * 0x1c RING_BASE_HI (R/W)
+ * 0x20 RING_SIZE (R/W): size in bytes of the log ring in guest memory, a
+ *      power of two (0 disables the ring).
+ * 0x24 RING_HEAD (R/W): the guest's producer index (free running, in
+ *      bytes). Writing it makes the device fetch the bytes up to the
+ *      head with DMA through dma_socket. Guests typically write it on
+ *      newline or when the ring is full.
+ * 0x28 RING_TAIL (R): the device's consumer index.
+ * 0x2c PROF_BEGIN (W): open a profiling region for the written marker ID.
+ * 0x30 PROF_END (W): close the innermost open region of the marker ID.
+ *      Regions nest, inner regions still open are dropped.
+ * 0x34 PROF_NAME_ID (W): select a marker ID to name and clear its name.
+ * 0x38 PROF_NAME (W): append 1 to 8 bytes to the selected marker's name,
+ *      NUL bytes are skipped.
+ * 0x40 PERF_SAMPLE (W): sample the host and kernel counters below.
+ * 0x44 PERF_HOST_NS_LO (R): host monotonic time in ns since the start of
+ *      the simulation, at the last sample.
+ * 0x48 PERF_HOST_NS_HI (R)
+ * 0x4c PERF_SPEED (R): simulated time / host time between the last two
+ *      samples, in millionths (saturating).
+ * 0x50 PERF_DELTAS (R): SystemC delta cycles at the last sample.
+ *
+ * The console output (PUTCHAR, CONSOLE_FIFO, the log ring and TRACE) is
+ * collected in a line buffer that is handed to a host writer thread on
+ * newline or when full, so the simulation never blocks on the host I/O.
+ * The console registers complete without the 1 us access delay of the
+ * other registers, so logging does not perturb the guest timing.
+ *
+ * All readable registers are accessible through transport_dbg (without
+ * side effects) and the registers below 0x60 through read only DMI of a
+ * shadow page, refreshed on register writes and once per global quantum.
+ *
+ * A summary of the simulated time, host time and delta cycles is printed
+ * at the end of the simulation.
+ *
+ * Profiling regions are timed in simulated time at the initiator's local
+ * time, also without access delay. The count, total, min, max and
+ * percentiles of the region times (and the time spent outside of nested
+ * regions) of each marker are reported at the end of the simulation.
+ */
+enum {
+	DEBUGDEV_R_TRACE		= 0x00,
+	DEBUGDEV_R_PUTCHAR		= 0x04,
+	DEBUGDEV_R_STOP			= 0x08,
+	DEBUGDEV_R_IRQ			= 0x0c,
+	DEBUGDEV_R_CLOCK		= 0x10,
+	DEBUGDEV_R_CONSOLE_FIFO		= 0x14,
+	DEBUGDEV_R_RING_BASE_LO		= 0x18,
+	DEBUGDEV_R_RING_BASE_HI		= 0x1c,
+	DEBUGDEV_R_RING_SIZE		= 0x20,
+	DEBUGDEV_R_RING_HEAD		= 0x24,
+	DEBUGDEV_R_RING_TAIL		= 0x28,
+	DEBUGDEV_R_PROF_BEGIN		= 0x2c,
+	DEBUGDEV_R_PROF_END		= 0x30,
+	DEBUGDEV_R_PROF_NAME_ID		= 0x34,
+	DEBUGDEV_R_PROF_NAME		= 0x38,
+	DEBUGDEV_R_PERF_SAMPLE		= 0x40,
+	DEBUGDEV_R_PERF_HOST_NS_LO	= 0x44,
+	DEBUGDEV_R_PERF_HOST_NS_HI	= 0x48,
+	DEBUGDEV_R_PERF_SPEED		= 0x4c,
+	DEBUGDEV_R_PERF_DELTAS		= 0x50,
+};
+
+#define DEBUGDEV_STOP_STATUS_MASK	0xff
+#define DEBUGDEV_STOP_SNAPSHOT		(1 << 8)
+
+#define DEBUGDEV_SHADOW_SIZE 0x60
+
+class debugdev_console;
+class debugdev_profiler;
+
 class debugdev
 : public sc_core::sc_module
 {
 public:
 	tlm_utils::simple_target_socket<debugdev> socket;
+	/* Log ring DMA, the ring is unavailable if left unbound.  */
+	tlm_utils::simple_initiator_socket_optional<debugdev> dma_socket;
 	sc_out<bool> irq[NUM_DBG_IRQ];
 
 	debugdev(sc_core::sc_module_name name);
+	~debugdev();
+	SC_HAS_PROCESS(debugdev);
 	virtual void b_transport(tlm::tlm_generic_payload& trans,
 					sc_time& delay);
 	virtual unsigned int transport_dbg(tlm::tlm_generic_payload& trans);
+	virtual bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+					tlm::tlm_dmi& dmi_data);
 
 	void before_end_of_elaboration();
+	void start_of_simulation();
+	void end_of_simulation();
+
+	/* Exit status of the first STOP of any debugdev, 0 if none.  */
+	static int exit_status(void);
 
 private:
 	sc_signal<bool> irq_tieoff[NUM_DBG_IRQ];
+
+	/*
+	 * IRQ register, driven on the irq outputs at the initiator's local
+	 * time (the initiator may be running ahead of the kernel).
+	 */
+	uint32_t irq_val;
+	sc_event ev_update_irqs;
+	void update_irqs(void);
+
+	debugdev_console *console;
+
+	/* Log ring in guest memory.  */
+	uint64_t ring_base;
+	uint32_t ring_size;
+	uint32_t ring_head;
+	uint32_t ring_tail;
+	sc_event ev_ring;
+	void ring_thread(void);
+	void console_access(tlm::tlm_generic_payload& trans);
+
+	/* Time of the previous register write, for the TRACE diff.  */
+	sc_time last_ts;
+
+	debugdev_profiler *prof;
+	void prof_access(tlm::tlm_generic_payload& trans, sc_time now);
+
+	uint32_t read_reg(sc_dt::uint64 addr, sc_time now);
+
+	/* Shadow register page for DMI.  */
+	uint32_t shadow[DEBUGDEV_SHADOW_SIZE / 4];
+	bool shadow_active;
+	sc_event ev_shadow;
+	void update_shadow(void);
+	void refresh_shadow(void);
+
+	/* Host and kernel performance counters.  */
+	struct perf_sample {
+		uint64_t host_ns;
+		sc_time sim;
+		uint64_t deltas;
+	};
+	uint64_t host_start_ns;
+	perf_sample perf_prev;
+	perf_sample perf_cur;
+	uint32_t perf_speed;
+	uint64_t host_ns(void);
+	void perf_take_sample(sc_time now);
+
+	static bool stopped;
+	static int stop_status;
+	void stop(uint32_t v, sc_time now);
+	void write_snapshot(sc_time now);
 };
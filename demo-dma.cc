@@ -29,6 +29,7 @@
 
 #include "tlm_utils/simple_initiator_socket.h"
 #include "tlm_utils/simple_target_socket.h"
+#include "tlm_utils/tlm_quantumkeeper.h"
 
 using namespace sc_core;
 using namespace std;
@@ -48,10 +49,10 @@ demodma::demodma(sc_module_name name)
 }
 
 void demodma::do_dma_trans(tlm::tlm_command cmd, unsigned char *buf,
-				sc_dt::uint64 addr, sc_dt::uint64 len)
+				sc_dt::uint64 addr, sc_dt::uint64 len,
+				sc_time &delay)
 {
 	tlm::tlm_generic_payload tr;
-	sc_time delay = SC_ZERO_TIME;
 
 	tr.set_command(cmd);
 	tr.set_address(addr);
@@ -88,20 +89,33 @@ void demodma::update_irqs(void)
 	irq.write(regs.ctrl & DEMODMA_CTRL_DONE);
 }
 
+/*
+ * The copy runs ahead of the simulation time on the local time of the
+ * quantum keeper and only yields to the kernel at the quantum boundary and
+ * when the copy is done, which is synchronized so that the done interrupt
+ * fires at the right time.
+ */
 void demodma::do_dma_copy(void)
 {
 	unsigned char buf[32];
 
+	m_qk.reset();
 	while (true) {
 		if (!(regs.ctrl & DEMODMA_CTRL_RUN)) {
 			wait(ev_dma_copy);
+			/* The local time accumulated before idling is stale.  */
+			m_qk.reset();
 		}
 
 		if (regs.len > 0 && regs.ctrl & DEMODMA_CTRL_RUN) {
 			unsigned int tlen = regs.len > sizeof buf ? sizeof buf : regs.len;
+			sc_time delay = m_qk.get_local_time();
 
-			do_dma_trans(tlm::TLM_READ_COMMAND, buf, regs.src_addr, tlen);
-			do_dma_trans(tlm::TLM_WRITE_COMMAND, buf, regs.dst_addr, tlen);
+			do_dma_trans(tlm::TLM_READ_COMMAND, buf, regs.src_addr,
+					tlen, delay);
+			do_dma_trans(tlm::TLM_WRITE_COMMAND, buf, regs.dst_addr,
+					tlen, delay);
+			m_qk.set(delay);
 
 			regs.dst_addr += tlen;
 			regs.src_addr += tlen;
@@ -109,12 +123,16 @@ void demodma::do_dma_copy(void)
 		}
 
 		if (regs.len == 0 && regs.ctrl & DEMODMA_CTRL_RUN) {
+			m_qk.sync();
 			regs.ctrl &= ~DEMODMA_CTRL_RUN;
 			/* If the DMA was running, signal done.  */
 			regs.ctrl |= DEMODMA_CTRL_DONE;
 		} else {
 			// Artificial delay between bursts.
-			wait(sc_time(1, SC_US));
+			m_qk.inc(sc_time(1, SC_US));
+			if (m_qk.need_sync()) {
+				m_qk.sync();
+			}
 		}
 		update_irqs();
 	}
@@ -149,7 +167,8 @@ void demodma::b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
 		switch (addr) {
 			case 3:
 				// speculative read for testing inline path.
-				do_dma_trans(tlm::TLM_READ_COMMAND, buf, regs.src_addr, 4);
+				do_dma_trans(tlm::TLM_READ_COMMAND, buf,
+						regs.src_addr, 4, delay);
 				/* The dma copies after a usec.  */
 				ev_dma_copy.notify(delay + sc_time(1, SC_US));
 				break;
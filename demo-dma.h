@@ -56,8 +56,12 @@ private:
 	} regs;
 
 	sc_event ev_dma_copy;
+	// Local time of the copy thread (temporal decoupling).
+	tlm_utils::tlm_quantumkeeper m_qk;
+
 	void do_dma_trans(tlm::tlm_command cmd, unsigned char *buf,
-			sc_dt::uint64 addr, sc_dt::uint64 len);
+			sc_dt::uint64 addr, sc_dt::uint64 len,
+			sc_time &delay);
 	void do_dma_copy(void);
 	void update_irqs(void);
 
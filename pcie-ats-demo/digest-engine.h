@@ -0,0 +1,374 @@
+/*
+ * Digest / checksum engines used by the PCIe accelerator demo.
+ *
+ * Copyright (c) 2021 Xilinx Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __DIGEST_ENGINE_H__
+#define __DIGEST_ENGINE_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <openssl/evp.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+//
+// Generic digest engine interface. The engine is initialized with init(),
+// fed with update() and the digest (digest_length() bytes) is obtained
+// with final().
+//
+class digest_engine
+{
+public:
+	enum {
+		//
+		// Algorithms (the values are the ones programmed in the
+		// R_CTRL algorithm-select field of the accelerator)
+		//
+		ALGO_MD5 = 0,
+		ALGO_SHA256 = 1,
+		ALGO_CRC32C = 2,
+		ALGO_XXH64 = 3,
+		NR_ALGOS,
+
+		MAX_DIGEST_LENGTH = 32,
+	};
+
+	virtual ~digest_engine() {}
+
+	virtual const char *name() = 0;
+	virtual unsigned int digest_length() = 0;
+
+	virtual bool init() = 0;
+	virtual void update(const uint8_t *data, size_t len) = 0;
+	virtual void final(uint8_t *digest) = 0;
+};
+
+//
+// OpenSSL EVP based engines (MD5, SHA-256). OpenSSL selects the hardware
+// accelerated implementations (e.g. SHA-NI) available on the host.
+//
+class evp_digest_engine : public digest_engine
+{
+public:
+	evp_digest_engine(const char *name, const EVP_MD *md) :
+		m_name(name),
+		m_md(md),
+		m_ctx(EVP_MD_CTX_new())
+	{}
+
+	~evp_digest_engine()
+	{
+		EVP_MD_CTX_free(m_ctx);
+	}
+
+	const char *name() { return m_name; }
+	unsigned int digest_length() { return EVP_MD_size(m_md); }
+
+	bool init()
+	{
+		return m_ctx && EVP_DigestInit_ex(m_ctx, m_md, NULL) == 1;
+	}
+
+	void update(const uint8_t *data, size_t len)
+	{
+		EVP_DigestUpdate(m_ctx, data, len);
+	}
+
+	void final(uint8_t *digest)
+	{
+		EVP_DigestFinal_ex(m_ctx, digest, NULL);
+	}
+
+private:
+	const char *m_name;
+	const EVP_MD *m_md;
+	EVP_MD_CTX *m_ctx;
+};
+
+//
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the host
+// supports it and a table driven implementation otherwise. The digest is
+// the 32 bit CRC stored in little endian byte order.
+//
+class crc32c_engine : public digest_engine
+{
+public:
+	crc32c_engine() :
+		m_crc(0),
+		m_hw(false)
+	{
+		uint32_t i;
+		int j;
+
+		for (i = 0; i < 256; i++) {
+			uint32_t c = i;
+
+			for (j = 0; j < 8; j++) {
+				c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+			}
+			m_table[i] = c;
+		}
+
+#if defined(__x86_64__)
+		m_hw = __builtin_cpu_supports("sse4.2");
+#endif
+	}
+
+	const char *name() { return "CRC32C"; }
+	unsigned int digest_length() { return 4; }
+
+	bool init()
+	{
+		m_crc = 0xFFFFFFFF;
+		return true;
+	}
+
+	void update(const uint8_t *data, size_t len)
+	{
+#if defined(__x86_64__)
+		if (m_hw) {
+			m_crc = update_sse42(m_crc, data, len);
+			return;
+		}
+#endif
+		while (len--) {
+			m_crc = m_table[(m_crc ^ *data++) & 0xFF] ^ (m_crc >> 8);
+		}
+	}
+
+	void final(uint8_t *digest)
+	{
+		uint32_t crc = ~m_crc;
+		int i;
+
+		for (i = 0; i < 4; i++) {
+			digest[i] = crc >> (i * 8);
+		}
+	}
+
+private:
+#if defined(__x86_64__)
+	__attribute__((target("sse4.2")))
+	static uint32_t update_sse42(uint32_t crc, const uint8_t *data,
+					size_t len)
+	{
+		uint64_t c = crc;
+
+		while (len && ((uintptr_t) data & 7)) {
+			c = _mm_crc32_u8(c, *data++);
+			len--;
+		}
+		while (len >= 8) {
+			uint64_t v;
+
+			memcpy(&v, data, sizeof(v));
+			c = _mm_crc32_u64(c, v);
+			data += 8;
+			len -= 8;
+		}
+		while (len--) {
+			c = _mm_crc32_u8(c, *data++);
+		}
+		return c;
+	}
+#endif
+
+	uint32_t m_table[256];
+	uint32_t m_crc;
+	bool m_hw;
+};
+
+//
+// xxHash (XXH64, seed 0). The digest is the 64 bit hash stored in little
+// endian byte order.
+//
+class xxh64_engine : public digest_engine
+{
+public:
+	xxh64_engine() { init(); }
+
+	const char *name() { return "XXH64"; }
+	unsigned int digest_length() { return 8; }
+
+	bool init()
+	{
+		m_v[0] = P1 + P2;
+		m_v[1] = P2;
+		m_v[2] = 0;
+		m_v[3] = -P1;
+		m_total_len = 0;
+		m_buf_len = 0;
+		return true;
+	}
+
+	void update(const uint8_t *data, size_t len)
+	{
+		m_total_len += len;
+
+		if (m_buf_len) {
+			size_t n = 32 - m_buf_len;
+
+			if (n > len) {
+				n = len;
+			}
+			memcpy(m_buf + m_buf_len, data, n);
+			m_buf_len += n;
+			data += n;
+			len -= n;
+
+			if (m_buf_len < 32) {
+				return;
+			}
+			stripe(m_buf);
+			m_buf_len = 0;
+		}
+
+		while (len >= 32) {
+			stripe(data);
+			data += 32;
+			len -= 32;
+		}
+
+		memcpy(m_buf, data, len);
+		m_buf_len = len;
+	}
+
+	void final(uint8_t *digest)
+	{
+		const uint8_t *p = m_buf;
+		size_t len = m_buf_len;
+		uint64_t h;
+		int i;
+
+		if (m_total_len >= 32) {
+			h = rotl(m_v[0], 1) + rotl(m_v[1], 7) +
+				rotl(m_v[2], 12) + rotl(m_v[3], 18);
+			for (i = 0; i < 4; i++) {
+				h = (h ^ round(0, m_v[i])) * P1 + P4;
+			}
+		} else {
+			h = m_v[2] + P5;
+		}
+		h += m_total_len;
+
+		for (; len >= 8; p += 8, len -= 8) {
+			h ^= round(0, read64(p));
+			h = rotl(h, 27) * P1 + P4;
+		}
+		if (len >= 4) {
+			h ^= (uint64_t) read32(p) * P1;
+			h = rotl(h, 23) * P2 + P3;
+			p += 4;
+			len -= 4;
+		}
+		for (; len; p++, len--) {
+			h ^= *p * P5;
+			h = rotl(h, 11) * P1;
+		}
+
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+
+		for (i = 0; i < 8; i++) {
+			digest[i] = h >> (i * 8);
+		}
+	}
+
+private:
+	static const uint64_t P1 = 11400714785074694791ULL;
+	static const uint64_t P2 = 14029467366897019727ULL;
+	static const uint64_t P3 = 1609587929392839161ULL;
+	static const uint64_t P4 = 9650029242287828579ULL;
+	static const uint64_t P5 = 2870177450012600261ULL;
+
+	static uint64_t rotl(uint64_t v, int r)
+	{
+		return (v << r) | (v >> (64 - r));
+	}
+
+	static uint64_t round(uint64_t acc, uint64_t input)
+	{
+		acc += input * P2;
+		return rotl(acc, 31) * P1;
+	}
+
+	static uint64_t read64(const uint8_t *p)
+	{
+		uint64_t v;
+
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static uint32_t read32(const uint8_t *p)
+	{
+		uint32_t v;
+
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	void stripe(const uint8_t *p)
+	{
+		int i;
+
+		for (i = 0; i < 4; i++) {
+			m_v[i] = round(m_v[i], read64(p + i * 8));
+		}
+	}
+
+	uint64_t m_v[4];
+	uint64_t m_total_len;
+	uint8_t m_buf[32];
+	size_t m_buf_len;
+};
+
+//
+// Create the digest engine for an algorithm.
+//
+// algo: one of the digest_engine::ALGO_X values
+//
+// returns: the engine or NULL for unknown algorithms
+//
+static inline digest_engine *digest_engine_create(unsigned int algo)
+{
+	switch (algo) {
+	case digest_engine::ALGO_MD5:
+		return new evp_digest_engine("MD5", EVP_md5());
+	case digest_engine::ALGO_SHA256:
+		return new evp_digest_engine("SHA-256", EVP_sha256());
+	case digest_engine::ALGO_CRC32C:
+		return new crc32c_engine();
+	case digest_engine::ALGO_XXH64:
+		return new xxh64_engine();
+	default:
+		return NULL;
+	}
+}
+
+#endif /* __DIGEST_ENGINE_H__ */
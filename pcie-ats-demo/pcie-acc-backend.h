@@ -0,0 +1,484 @@
+/*
+ * Backends used by the host applications to drive the PCIe accelerator,
+ * either through VFIO or through an in-process instance of the model.
+ *
+ * Copyright (c) 2021 Xilinx Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __PCIE_ACC_BACKEND_H__
+#define __PCIE_ACC_BACKEND_H__
+
+#include <map>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+#include "tlm-bridges/tlm2vfio-bridge.h"
+#include "vfio-dma-mapper.h"
+#include "pcie-acc.h"
+
+//
+// Interface used by the host applications to access the accelerator's
+// BAR0, to make host memory available to the accelerator (see
+// dma_map_backend) and to wait for its interrupts.
+//
+class pcie_acc_backend : public dma_map_backend
+{
+public:
+	virtual void write32(uint32_t addr, uint32_t val) = 0;
+	virtual uint32_t read32(uint32_t addr) = 0;
+
+	//
+	// Returns true if the backend can wait for interrupts, else the
+	// application must poll.
+	//
+	virtual bool has_irqs() = 0;
+
+	//
+	// Sleep until the vector has fired at least once since the last
+	// call.
+	//
+	// vec: the vector
+	//
+	virtual void wait_irq(unsigned int vec) = 0;
+};
+
+//
+// Accelerator reached through VFIO. The accelerator's MSI-X vectors (MSI
+// if the device has no MSI-X) are routed to eventfds, if neither is
+// available has_irqs() returns false.
+//
+class pcie_acc_vfio_backend : public pcie_acc_backend
+{
+public:
+	vfio_dev vdev;
+
+	pcie_acc_vfio_backend(const char *devname, int iommu_group,
+				unsigned int nr_irqs = NR_IRQ) :
+		vdev(devname, iommu_group),
+		m_irq_fd(nr_irqs, -1),
+		m_irq_index(-1)
+	{
+		setup_irqs();
+	}
+
+	~pcie_acc_vfio_backend()
+	{
+		free_irqs();
+	}
+
+	void write32(uint32_t addr, uint32_t val)
+	{
+		// only using BAR0
+		uint8_t *map = (uint8_t *) vdev.map[0];
+
+		memcpy_to_io(map + addr, reinterpret_cast<uint8_t*>(&val), sizeof(val));
+	}
+
+	uint32_t read32(uint32_t addr)
+	{
+		// only using BAR0
+		uint8_t *map = (uint8_t *) vdev.map[0];
+		uint32_t val;
+
+		memcpy_from_io(reinterpret_cast<uint8_t*>(&val),
+				map + addr, sizeof(val));
+
+		return val;
+	}
+
+	void map_dma(void *vaddr, uint64_t iova, uint64_t size, bool write)
+	{
+		uint32_t flags = VFIO_DMA_MAP_FLAG_READ;
+
+		if (write) {
+			flags |= VFIO_DMA_MAP_FLAG_WRITE;
+		}
+		vdev.iommu_map_dma((uintptr_t) vaddr, iova, size, flags);
+	}
+
+	void unmap_dma(uint64_t iova, uint64_t size)
+	{
+		vdev.iommu_unmap_dma(iova, size,
+			VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE);
+	}
+
+	bool has_irqs() { return m_irq_index >= 0; }
+
+	void wait_irq(unsigned int vec)
+	{
+		uint64_t cnt;
+
+		if (read(m_irq_fd[vec], &cnt, sizeof(cnt)) != sizeof(cnt)) {
+			perror("read eventfd");
+		}
+	}
+
+private:
+	void setup_irqs()
+	{
+		static const unsigned int index[] = {
+			VFIO_PCI_MSIX_IRQ_INDEX,
+			VFIO_PCI_MSI_IRQ_INDEX,
+		};
+		std::vector<uint8_t> buf(sizeof(struct vfio_irq_set) +
+					sizeof(int) * m_irq_fd.size());
+		struct vfio_irq_set *irq_set =
+			reinterpret_cast<struct vfio_irq_set *>(buf.data());
+		unsigned int i;
+
+		for (i = 0; i < m_irq_fd.size(); i++) {
+			m_irq_fd[i] = eventfd(0, 0);
+			if (m_irq_fd[i] < 0) {
+				perror("eventfd");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		irq_set->argsz = buf.size();
+		irq_set->flags = VFIO_IRQ_SET_DATA_EVENTFD |
+				VFIO_IRQ_SET_ACTION_TRIGGER;
+		irq_set->start = 0;
+		irq_set->count = m_irq_fd.size();
+		memcpy(irq_set->data, m_irq_fd.data(),
+			sizeof(int) * m_irq_fd.size());
+
+		for (i = 0; i < sizeof(index) / sizeof(index[0]); i++) {
+			irq_set->index = index[i];
+
+			if (ioctl(vdev.device, VFIO_DEVICE_SET_IRQS,
+					irq_set) == 0) {
+				m_irq_index = index[i];
+				return;
+			}
+		}
+
+		std::cout << "No MSI-X / MSI support, polling for completions"
+			<< std::endl;
+		free_irqs();
+	}
+
+	void free_irqs()
+	{
+		unsigned int i;
+
+		if (m_irq_index >= 0) {
+			struct vfio_irq_set irq_set;
+
+			irq_set.argsz = sizeof(irq_set);
+			irq_set.flags = VFIO_IRQ_SET_DATA_NONE |
+					VFIO_IRQ_SET_ACTION_TRIGGER;
+			irq_set.index = m_irq_index;
+			irq_set.start = 0;
+			irq_set.count = 0;
+			ioctl(vdev.device, VFIO_DEVICE_SET_IRQS, &irq_set);
+			m_irq_index = -1;
+		}
+
+		for (i = 0; i < m_irq_fd.size(); i++) {
+			if (m_irq_fd[i] >= 0) {
+				close(m_irq_fd[i]);
+				m_irq_fd[i] = -1;
+			}
+		}
+	}
+
+	std::vector<int> m_irq_fd;
+	int m_irq_index;
+};
+
+//
+// In-process stand-in for the accelerator: a pcie_acc instance is
+// simulated next to the host application, which must run in a SystemC
+// thread. The stand-in plays the host side of the PCIe link: it serves
+// the accelerator's ATS requests from the DMA mappings (acting as the
+// IOMMU, the "physical" addresses returned are host virtual addresses),
+// serves the DMA with memcpy and sends ATS invalidations on unmap.
+//
+// ATS requests are answered with naturally aligned translations of up to
+// 'page_size' bytes, the way an IOMMU using pages of that size would.
+//
+class pcie_acc_loopback : public sc_core::sc_module, public pcie_acc_backend
+{
+public:
+	SC_HAS_PROCESS(pcie_acc_loopback);
+
+	pcie_acc acc;
+
+	//
+	// page_size: the IOMMU page size
+	// mmio_latency: the time a BAR access takes
+	//
+	pcie_acc_loopback(sc_core::sc_module_name name,
+			uint64_t page_size = 4 * 1024,
+			sc_time mmio_latency = sc_time(100, SC_NS)) :
+		sc_module(name),
+		acc("acc"),
+		bar_sk("bar-sk"),
+		config_sk("config-sk"),
+		ats_inv_sk("ats-inv-sk"),
+		dma_sk("dma-sk"),
+		ats_req_sk("ats-req-sk"),
+		rst("rst"),
+		irq("irq", NR_IRQ),
+		m_page_size(page_size),
+		m_mmio_latency(mmio_latency)
+	{
+		unsigned int i;
+
+		bar_sk.bind(acc.bar[0]);
+		config_sk.bind(acc.config);
+		ats_inv_sk.bind(acc.ats_inv);
+		acc.dma.bind(dma_sk);
+		acc.ats_req.bind(ats_req_sk);
+		acc.rst(rst);
+
+		dma_sk.register_b_transport(this,
+				&pcie_acc_loopback::b_transport_dma);
+		ats_req_sk.register_b_transport(this,
+				&pcie_acc_loopback::b_transport_ats_req);
+
+		for (i = 0; i < NR_IRQ; i++) {
+			acc.irq[i](irq[i]);
+			m_irq_count[i] = 0;
+			sc_spawn(sc_bind(&pcie_acc_loopback::irq_thread,
+						this, i));
+		}
+	}
+
+	void write32(uint32_t addr, uint32_t val)
+	{
+		bar_access(tlm::TLM_WRITE_COMMAND, addr, &val);
+	}
+
+	uint32_t read32(uint32_t addr)
+	{
+		uint32_t val = 0;
+
+		bar_access(tlm::TLM_READ_COMMAND, addr, &val);
+		return val;
+	}
+
+	void map_dma(void *vaddr, uint64_t iova, uint64_t size, bool write)
+	{
+		Mapping m;
+
+		m.host = reinterpret_cast<uint8_t *>(vaddr);
+		m.size = size;
+		m.write = write;
+		m_maps[iova] = m;
+	}
+
+	void unmap_dma(uint64_t iova, uint64_t size)
+	{
+		sc_time delay(SC_ZERO_TIME);
+		tlm::tlm_generic_payload gp;
+		atsattr_extension atsattr;
+
+		//
+		// Invalidate the accelerator's cached translations
+		//
+		gp.set_extension(&atsattr);
+		gp.set_command(tlm::TLM_IGNORE_COMMAND);
+		gp.set_address(iova);
+		atsattr.set_length(size);
+
+		ats_inv_sk->b_transport(gp, delay);
+
+		gp.clear_extension(&atsattr);
+
+		m_maps.erase(iova);
+	}
+
+	bool has_irqs() { return true; }
+
+	void wait_irq(unsigned int vec)
+	{
+		while (m_irq_count[vec] == 0) {
+			wait(m_irq_event[vec]);
+		}
+		m_irq_count[vec] = 0;
+	}
+
+	//
+	// Change the IOMMU page size, applies to the translations returned
+	// after the call.
+	//
+	// page_size: the IOMMU page size
+	//
+	void set_page_size(uint64_t page_size)
+	{
+		m_page_size = page_size;
+	}
+
+private:
+	struct Mapping {
+		uint8_t *host;
+		uint64_t size;
+		bool write;
+	};
+
+	void bar_access(tlm::tlm_command cmd, uint32_t addr, uint32_t *val)
+	{
+		sc_time delay(SC_ZERO_TIME);
+		tlm::tlm_generic_payload gp;
+
+		gp.set_command(cmd);
+		gp.set_address(addr);
+		gp.set_data_ptr(reinterpret_cast<unsigned char*>(val));
+		gp.set_data_length(sizeof(*val));
+		gp.set_streaming_width(sizeof(*val));
+
+		bar_sk->b_transport(gp, delay);
+
+		//
+		// Let the accelerator run while the host waits for the access
+		//
+		wait(delay + m_mmio_latency);
+	}
+
+	//
+	// Returns the mapping containing iova or NULL.
+	//
+	Mapping *find(uint64_t iova, uint64_t *map_iova)
+	{
+		std::map<uint64_t, Mapping>::iterator it;
+
+		it = m_maps.upper_bound(iova);
+		if (it == m_maps.begin()) {
+			return NULL;
+		}
+		it--;
+
+		if (iova - it->first >= it->second.size) {
+			return NULL;
+		}
+		*map_iova = it->first;
+		return &it->second;
+	}
+
+	//
+	// The accelerator's ATS translation requests are received here.
+	//
+	void b_transport_ats_req(tlm::tlm_generic_payload &trans,
+				sc_time &delay)
+	{
+		uint64_t page = trans.get_address() & ~((uint64_t) SZ_4K - 1);
+		atsattr_extension *atsattr;
+		uint64_t map_iova;
+		uint64_t attr;
+		uint64_t len;
+		Mapping *m;
+
+		trans.get_extension(atsattr);
+		assert(atsattr);
+
+		m = find(page, &map_iova);
+		if (!m) {
+			atsattr->set_result(atsattr_extension::RESULT_ERROR);
+			trans.set_response_status(tlm::TLM_OK_RESPONSE);
+			return;
+		}
+
+		//
+		// Grow the translation up to the page size while it stays
+		// naturally aligned and inside the mapping
+		//
+		len = SZ_4K;
+		while (len * 2 <= m_page_size &&
+			!(page & (len * 2 - 1)) &&
+			page + len * 2 <= map_iova + m->size) {
+			len *= 2;
+		}
+
+		attr = atsattr_extension::ATTR_READ;
+		if (m->write) {
+			attr |= atsattr_extension::ATTR_WRITE;
+		}
+
+		trans.set_address(reinterpret_cast<uintptr_t>(m->host) +
+					(page - map_iova));
+		atsattr->set_attributes(attr);
+		atsattr->set_length(len);
+		atsattr->set_result(atsattr_extension::RESULT_OK);
+		trans.set_response_status(tlm::TLM_OK_RESPONSE);
+	}
+
+	//
+	// The accelerator's DMA (to the addresses returned by the ATS
+	// requests) is received here.
+	//
+	void b_transport_dma(tlm::tlm_generic_payload &trans, sc_time &delay)
+	{
+		uint8_t *addr = reinterpret_cast<uint8_t *>(trans.get_address());
+		unsigned int len = trans.get_data_length();
+		std::map<uint64_t, Mapping>::iterator it;
+
+		for (it = m_maps.begin(); it != m_maps.end(); it++) {
+			Mapping &m = it->second;
+
+			if (addr >= m.host && addr + len <= m.host + m.size) {
+				if (trans.is_read()) {
+					memcpy(trans.get_data_ptr(), addr, len);
+				} else if (m.write) {
+					memcpy(addr, trans.get_data_ptr(), len);
+				} else {
+					break;
+				}
+				trans.set_response_status(tlm::TLM_OK_RESPONSE);
+				return;
+			}
+		}
+
+		trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
+	}
+
+	void irq_thread(unsigned int vec)
+	{
+		while (true) {
+			wait(irq[vec].posedge_event());
+
+			m_irq_count[vec]++;
+			m_irq_event[vec].notify();
+		}
+	}
+
+	enum { SZ_4K = 4 * 1024 };
+
+	tlm_utils::simple_initiator_socket<pcie_acc_loopback> bar_sk;
+	tlm_utils::simple_initiator_socket<pcie_acc_loopback> config_sk;
+	tlm_utils::simple_initiator_socket<pcie_acc_loopback> ats_inv_sk;
+	tlm_utils::simple_target_socket<pcie_acc_loopback> dma_sk;
+	tlm_utils::simple_target_socket<pcie_acc_loopback> ats_req_sk;
+
+	sc_signal<bool> rst;
+	sc_vector<sc_signal<bool> > irq;
+
+	unsigned int m_irq_count[NR_IRQ];
+	sc_event m_irq_event[NR_IRQ];
+
+	// IOVA to mapping
+	std::map<uint64_t, Mapping> m_maps;
+
+	uint64_t m_page_size;
+	sc_time m_mmio_latency;
+};
+
+#endif /* __PCIE_ACC_BACKEND_H__ */
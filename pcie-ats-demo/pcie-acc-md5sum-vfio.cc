@@ -26,6 +26,12 @@
 
 #include <sstream>
 #include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <getopt.h>
 
 #define SC_INCLUDE_DYNAMIC_PROCESSES
 
@@ -39,16 +45,21 @@ using namespace std;
 #include "tlm_utils/simple_target_socket.h"
 
 #include "tlm-modules/tlm-splitter.h"
-#include "tlm-bridges/tlm2vfio-bridge.h"
+#include "pcie-acc-backend.h"
 
 #define SZ_4K (4 * 1024)
 #define SZ_32K (32 * 1024)
+#define SZ_2M (2 * 1024 * 1024)
+
+//
+// IOVA space used for the input buffers
+//
+#define IOVA_BASE SZ_32K
+#define IOVA_SIZE (1ULL << 40)
 
 // Top simulation module.
 SC_MODULE(Top)
 {
-	vfio_dev vdev;
-
 	SC_HAS_PROCESS(Top);
 
 	enum {
@@ -62,6 +73,7 @@ SC_MODULE(Top)
 		R_MD5_RESULT_1 = 0x1C,
 		R_MD5_RESULT_2 = 0x20,
 		R_MD5_RESULT_3 = 0x24,
+		R_IRQ_ENABLE = 0x78,
 
 		R_CTRL_TRANSLATE = 1 << 0,
 		R_CTRL_READ = 1 << 1,
@@ -70,170 +82,438 @@ SC_MODULE(Top)
 
 		R_STATUS_DONE = 1 << 0,
 		R_STATUS_ERR = 1 << 1,
+
+		IRQ_DONE = 0,
+	};
+
+	//
+	// How the input files are placed in memory
+	//
+	enum BufMode {
+		// mmap of the file (4 KiB pages)
+		BUF_FILE,
+		// Copy into anonymous MAP_HUGETLB memory
+		BUF_HUGETLB,
+		// Copy into a file on a hugetlbfs mount
+		BUF_HUGETLBFS,
 	};
 
-	Top(sc_module_name name, const char *devname, int iommu_group,
-			const char *filename) :
+	Top(sc_module_name name, pcie_acc_backend &be,
+			const vector<string> &files, BufMode mode,
+			const char *hugetlbfs_dir) :
 		sc_module(name),
-		vdev(devname, iommu_group),
-		m_filename(filename)
+		m_be(be),
+		m_files(files),
+		m_mode(mode),
+		m_hugetlbfs_dir(hugetlbfs_dir),
+		m_mapper(be, IOVA_BASE, IOVA_SIZE),
+		nr_failed(0)
 	{
 		SC_THREAD(run_md5);
 	}
 
+	struct InputBuf {
+		uint8_t *data;
+		uint64_t size;
+		uint64_t map_size;
+	};
+
 	//
-	// Compute the MD5 message digest on input file
+	// Place a file in memory, according to the buffer mode.
 	//
-	void run_md5()
+	// filename: the file
+	// buf: the buffer description is returned here
+	//
+	// returns: true on success
+	//
+	bool load_file(const char *filename, InputBuf *buf)
 	{
-		uintptr_t map_uint;
-		uint64_t map_size;
-		uint8_t *tmp;
+		uint64_t page_size = m_mode == BUF_FILE ? SZ_4K : SZ_2M;
 		struct stat s;
-		void *mbuf;
+		void *m = MAP_FAILED;
 		int fd;
 
-		cout << endl << " * MD5: " << m_filename << endl;
-
-		//
-		// Open the file and get file stats
-		//
-		fd = open(m_filename, O_RDWR);
+		fd = open(filename, O_RDONLY);
 		if (fd < 0) {
 			perror("open");
-			exit(EXIT_FAILURE);
+			return false;
 		}
 		if (fstat(fd, &s) < 0) {
 			perror("fstat");
-			goto err1;
+			goto err;
 		}
 
-		//
-		// Calculate map_size
-		//
-		map_size = (s.st_size / SZ_4K) * SZ_4K;
-		if (s.st_size % SZ_4K) {
-			map_size += SZ_4K;
+		buf->size = s.st_size;
+		buf->map_size = (s.st_size + page_size - 1) & ~(page_size - 1);
+		if (buf->map_size == 0) {
+			buf->map_size = page_size;
 		}
 
+		if (m_mode == BUF_FILE && s.st_size) {
+			m = mmap(NULL, buf->map_size, PROT_READ, MAP_SHARED,
+				fd, 0);
+		} else if (m_mode == BUF_HUGETLBFS) {
+			string path = string(m_hugetlbfs_dir) +
+					"/pcie-acc-md5sum-XXXXXX";
+			vector<char> tmpl(path.begin(), path.end());
+			int hfd;
+
+			tmpl.push_back('\0');
+			hfd = mkstemp(tmpl.data());
+			if (hfd < 0) {
+				perror("mkstemp");
+				goto err;
+			}
+			unlink(tmpl.data());
+
+			if (ftruncate(hfd, buf->map_size) == 0) {
+				m = mmap(NULL, buf->map_size,
+					PROT_READ | PROT_WRITE, MAP_SHARED,
+					hfd, 0);
+			}
+			close(hfd);
+		} else {
+			int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+			if (m_mode == BUF_HUGETLB) {
+				flags |= MAP_HUGETLB;
+			}
+			m = mmap(NULL, buf->map_size, PROT_READ | PROT_WRITE,
+				flags, -1, 0);
+		}
+
+		if (m == MAP_FAILED) {
+			perror("mmap");
+			goto err;
+		}
+		buf->data = (uint8_t *) m;
+
 		//
-		// mmap the file
+		// Copy the file into the hugepages
 		//
-		mbuf = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-		if (mbuf == MAP_FAILED) {
-			perror("mmap");
-			goto err1;
+		if (m_mode != BUF_FILE) {
+			uint64_t done = 0;
+
+			while (done < buf->size) {
+				ssize_t r = read(fd, buf->data + done,
+						buf->size - done);
+
+				if (r <= 0) {
+					perror("read");
+					munmap(m, buf->map_size);
+					goto err;
+				}
+				done += r;
+			}
 		}
 
 		//
 		// Lock pages to allow direct DMA.
 		//
-		mlock(mbuf, map_size);
+		mlock(buf->data, buf->map_size);
+
+		close(fd);
+		return true;
+err:
+		close(fd);
+		return false;
+	}
+
+	void release_file(InputBuf *buf)
+	{
+		if (munmap(buf->data, buf->map_size)) {
+			perror("munmap");
+		}
+	}
+
+	//
+	// Compute the MD5 message digest of a file
+	//
+	// filename: the file
+	// bytes: the file size is added here
+	//
+	// returns: true on success
+	//
+	bool md5_file(const char *filename, uint64_t *bytes)
+	{
+		chrono::steady_clock::time_point start;
+		chrono::duration<double> wall;
+		uint64_t align = m_mode == BUF_FILE ? SZ_4K : SZ_2M;
+		sc_time sim_start;
+		InputBuf buf;
+		uint64_t iova;
+		uint32_t status;
+
+		cout << endl << " * MD5: " << filename << endl;
+
+		if (!load_file(filename, &buf)) {
+			return false;
+		}
+
+		if (buf.size > UINT32_MAX) {
+			cout << "   - too large (R_LENGTH is 32 bit)" << endl;
+			release_file(&buf);
+			return false;
+		}
+
+		start = chrono::steady_clock::now();
+		sim_start = sc_time_stamp();
 
 		//
-		// VFIO map.
+		// VFIO map, hugepage backed buffers are aligned so that
+		// they can be mapped with hugepages
 		//
-		tmp = (uint8_t *) mbuf;
-		map_uint = (uintptr_t) tmp;
-		vdev.iommu_map_dma(map_uint, SZ_32K, map_size,
-			VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE);
+		if (!m_mapper.map(buf.data, buf.map_size, false, &iova,
+					align)) {
+			cout << "   - out of IOVA space" << endl;
+			release_file(&buf);
+			return false;
+		}
 
 		//
 		// MD5 configuration & computation
 		//
-		write32(R_ADDR_MSB, 0);
-		write32(R_ADDR_LSB, SZ_32K);
-		write32(R_LENGTH, s.st_size);
+		m_be.write32(R_ADDR_MSB, iova >> 32);
+		m_be.write32(R_ADDR_LSB, iova);
+		m_be.write32(R_LENGTH, buf.size);
 
-		write32(R_STATUS, 0);
-		write32(R_CTRL, R_CTRL_MD5SUM);
-		wait_for_done();
+		m_be.write32(R_STATUS, 0);
+		m_be.write32(R_CTRL, R_CTRL_MD5SUM);
+		status = wait_for_done();
 
 		//
-		// MD5 result
+		// VFIO unmap, dropping the cached mapping too as the buffer
+		// is about to go away
 		//
-		cout << "   - MD5 result: ";
-		for (uint32_t addr = R_MD5_RESULT_0;
-			addr <= R_MD5_RESULT_3; addr +=4) {
-			uint32_t r = read32(addr);
-
-			cout << hex << right
-				<< setw(2) << setfill('0')
-				<< ((r >> 0) & 0xFF)
-				<< ((r >> 8) & 0xFF)
-				<< ((r >> 16) & 0xFF)
-				<< ((r >> 24) & 0xFF);
-		}
-		cout << endl;
-
-		//
-		// VFIO unmap.
-		//
-		vdev.iommu_unmap_dma((uintptr_t) SZ_32K, map_size,
-			VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE);
+		m_mapper.unmap(buf.data, buf.map_size);
+		m_mapper.flush();
 
+		wall = chrono::steady_clock::now() - start;
 
 		//
-		// munmap.
+		// MD5 result
 		//
-		if (munmap(mbuf, s.st_size) ) {
-			perror("munmap");
+		if (status & R_STATUS_ERR) {
+			cout << "   - MD5 failed" << endl;
+		} else {
+			cout << "   - MD5 result: ";
+			for (uint32_t addr = R_MD5_RESULT_0;
+				addr <= R_MD5_RESULT_3; addr +=4) {
+				uint32_t r = m_be.read32(addr);
+
+				cout << hex << right
+					<< setw(2) << setfill('0')
+					<< ((r >> 0) & 0xFF)
+					<< setw(2) << setfill('0')
+					<< ((r >> 8) & 0xFF)
+					<< setw(2) << setfill('0')
+					<< ((r >> 16) & 0xFF)
+					<< setw(2) << setfill('0')
+					<< ((r >> 24) & 0xFF);
+			}
+			cout << dec << endl;
 		}
 
-		close(fd);
+		report("   - ", buf.size, wall.count(),
+			sc_time_stamp() - sim_start);
 
-		sc_stop();
-		return;
-err1:
-		close(fd);
-		exit(EXIT_FAILURE);
+		release_file(&buf);
+
+		*bytes += buf.size;
+		return !(status & R_STATUS_ERR);
 	}
 
-	void write32(uint32_t addr, uint32_t val)
+	void report(const char *prefix, uint64_t bytes, double wall_s,
+			sc_time sim)
 	{
-		// only using BAR0
-		uint8_t *map = (uint8_t *) vdev.map[0];
-
-		memcpy_to_io(map + addr, reinterpret_cast<uint8_t*>(&val), sizeof(val));
+		cout << prefix << dec << bytes << " bytes in "
+			<< fixed << setprecision(3) << wall_s * 1000 << " ms";
+		if (wall_s > 0) {
+			cout << " (" << bytes / wall_s / 1e6 << " MB/s)";
+		}
+		cout << ", simulated " << sim.to_seconds() * 1000 << " ms";
+		if (sim.to_seconds() > 0) {
+			cout << " (" << bytes / sim.to_seconds() / 1e6
+				<< " MB/s)";
+		}
+		cout << endl;
+		cout.unsetf(ios::floatfield);
 	}
 
-	uint32_t read32(uint32_t addr)
+	void run_md5()
 	{
-		// only using BAR0
-		uint8_t *map = (uint8_t *) vdev.map[0];
-		uint32_t val;
+		chrono::steady_clock::time_point start;
+		chrono::duration<double> wall;
+		sc_time sim_start;
+		uint64_t bytes = 0;
+		unsigned int i;
+
+		if (m_be.has_irqs()) {
+			m_be.write32(R_IRQ_ENABLE, 1 << IRQ_DONE);
+		}
+
+		start = chrono::steady_clock::now();
+		sim_start = sc_time_stamp();
 
-		memcpy_from_io(reinterpret_cast<uint8_t*>(&val),
-				map + addr, sizeof(val));
+		for (i = 0; i < m_files.size(); i++) {
+			if (!md5_file(m_files[i].c_str(), &bytes)) {
+				nr_failed++;
+			}
+		}
 
-		return val;
+		wall = chrono::steady_clock::now() - start;
+
+		if (m_files.size() > 1) {
+			cout << endl << " * Total: " << m_files.size()
+				<< " files, " << nr_failed << " failed" << endl;
+			report("   - ", bytes, wall.count(),
+				sc_time_stamp() - sim_start);
+		}
+
+		if (m_be.has_irqs()) {
+			m_be.write32(R_IRQ_ENABLE, 0);
+		}
+
+		sc_stop();
 	}
 
-	void wait_for_done()
+	uint32_t wait_for_done()
 	{
 		uint32_t r;
 
+		if (!m_be.has_irqs()) {
+			do {
+				r = m_be.read32(R_STATUS);
+			} while (r == 0);
+			return r;
+		}
+
 		do {
-			r = read32(R_STATUS);
+			m_be.wait_irq(IRQ_DONE);
+			r = m_be.read32(R_STATUS);
 		} while (r == 0);
+		return r;
 	}
 
-	const char *m_filename;
+	pcie_acc_backend &m_be;
+	vector<string> m_files;
+	BufMode m_mode;
+	const char *m_hugetlbfs_dir;
+	vfio_dma_mapper m_mapper;
+
+	// Files whose digest could not be computed
+	unsigned int nr_failed;
 };
 
+//
+// Add a file, or the regular files in a directory, to the list of files
+// to compute the digest on.
+//
+static void add_input(const char *path, vector<string> *files)
+{
+	vector<string> entries;
+	struct dirent *de;
+	struct stat s;
+	DIR *dir;
+
+	if (stat(path, &s) < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	if (!S_ISDIR(s.st_mode)) {
+		files->push_back(path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (!dir) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	while ((de = readdir(dir)) != NULL) {
+		string f = string(path) + "/" + de->d_name;
+
+		if (stat(f.c_str(), &s) == 0 && S_ISREG(s.st_mode)) {
+			entries.push_back(f);
+		}
+	}
+	closedir(dir);
+
+	sort(entries.begin(), entries.end());
+	files->insert(files->end(), entries.begin(), entries.end());
+}
+
+static void usage(const char *prog)
+{
+	printf("%s: [options] device-name iommu-group file|directory...\n"
+		"%s: [options] -s file|directory...\n"
+		"  -s        use an in-process accelerator instead of VFIO\n"
+		"  -H        copy the input into MAP_HUGETLB memory\n"
+		"  -t dir    copy the input into files on a hugetlbfs mount\n",
+		prog, prog);
+}
+
 int sc_main(int argc, char *argv[])
 {
+	Top::BufMode mode = Top::BUF_FILE;
+	const char *hugetlbfs_dir = NULL;
+	pcie_acc_backend *be;
+	vector<string> files;
+	bool standin = false;
 	int iommu_group;
+	Top *top;
+	int ret;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sHt:")) != -1) {
+		switch (opt) {
+		case 's':
+			standin = true;
+			break;
+		case 'H':
+			mode = Top::BUF_HUGETLB;
+			break;
+		case 't':
+			mode = Top::BUF_HUGETLBFS;
+			hugetlbfs_dir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
 
-	if (argc < 4) {
-		printf("%s: device-name iommu-group filename\n", argv[0]);
-		exit(EXIT_FAILURE);
+	if (standin) {
+		if (optind >= argc) {
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		//
+		// The in-process IOMMU uses hugepages for the hugepage
+		// backed buffers
+		//
+		be = new pcie_acc_loopback("standin",
+				mode == Top::BUF_FILE ? SZ_4K : SZ_2M);
+	} else {
+		if (argc - optind < 3) {
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		iommu_group = strtoull(argv[optind + 1], NULL, 10);
+		be = new pcie_acc_vfio_backend(argv[optind], iommu_group);
+		optind += 2;
+	}
+
+	for (; optind < argc; optind++) {
+		add_input(argv[optind], &files);
 	}
 
-	iommu_group = strtoull(argv[2], NULL, 10);
-	Top top("Top", argv[1], iommu_group, argv[3]);
+	top = new Top("Top", *be, files, mode, hugetlbfs_dir);
 
 	sc_start();
 
-	return 0;
+	ret = top->nr_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+	delete top;
+	delete be;
+	return ret;
 }
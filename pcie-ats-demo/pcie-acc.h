@@ -31,10 +31,32 @@
 #include "tlm.h"
 #include "soc/pci/core/pci-device-base.h"
 #include "tlm-extensions/atsattr.h"
-#include <openssl/md5.h>
+#include "digest-engine.h"
+#include <map>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #define NR_MMIO_BAR  1
-#define NR_IRQ  0
+#define NR_IRQ  2
+
+//
+// Default ATC geometry (fully associative with 64 entries)
+//
+#define ATC_NR_ENTRIES  64
+#define ATC_NR_WAYS     64
+
+//
+// Default number of pages translated ahead of the consumer
+//
+#define ATC_PREFETCH_PAGES  8
+
+//
+// Default number of worker threads processing the job queue
+//
+#define NR_QUEUE_WORKERS  4
 
 class pcie_acc : public pci_device_base
 {
@@ -67,8 +89,7 @@ private:
 
 		uint64_t virt_to_phys(uint64_t virt_addr)
 		{
-			uint64_t m_mask = m_length-1;
-			return m_phys_addr | (virt_addr & m_mask);
+			return m_phys_addr + (virt_addr - m_virt_addr);
 		}
 	private:
 		uint64_t m_virt_addr;
@@ -77,86 +98,439 @@ private:
 		uint64_t m_attributes;
 	};
 
+	//
+	// Multi-buffered hashing pipeline. The SystemC thread producing the
+	// data fills a free buffer (get_buffer) and hands it over (submit)
+	// to a host thread that runs the update function on the buffers in
+	// order. This way the hashing overlaps with the DMA reads filling
+	// the next buffers.
+	//
+	class HashPipeline
+	{
+	public:
+		enum {
+			NR_BUFS = 4,
+			BUF_SIZE = 64 * 1024,
+		};
+
+		typedef std::function<void(const uint8_t *, size_t)> UpdateFn;
+
+		HashPipeline() :
+			m_bufs(NR_BUFS, std::vector<uint8_t>(BUF_SIZE)),
+			m_lens(NR_BUFS, 0),
+			m_head(0),
+			m_tail(0),
+			m_count(0),
+			m_stop(false),
+			m_thread(&HashPipeline::run, this)
+		{}
+
+		~HashPipeline()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_cond.notify_all();
+			m_thread.join();
+		}
+
+		//
+		// Set the update function used for the following buffers,
+		// the pipeline must be drained.
+		//
+		void start(UpdateFn update)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			assert(m_count == 0);
+			m_update = update;
+		}
+
+		//
+		// Returns a free buffer of BUF_SIZE bytes (waits for the
+		// host thread if all buffers are in use).
+		//
+		uint8_t *get_buffer()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			m_cond.wait(lock, [this] { return m_count < NR_BUFS; });
+			return m_bufs[m_head].data();
+		}
+
+		//
+		// Hand over the buffer returned by get_buffer for hashing.
+		//
+		void submit(size_t len)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				m_lens[m_head] = len;
+				m_head = (m_head + 1) % NR_BUFS;
+				m_count++;
+			}
+			m_cond.notify_all();
+		}
+
+		//
+		// Wait until all submitted buffers have been hashed.
+		//
+		void drain()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			m_cond.wait(lock, [this] { return m_count == 0; });
+		}
+
+	private:
+		void run()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			while (true) {
+				m_cond.wait(lock, [this] {
+					return m_stop || m_count > 0;
+				});
+				if (m_count == 0) {
+					// Stopped
+					return;
+				}
+
+				//
+				// The buffer stays owned by the pipeline until
+				// m_count is decremented
+				//
+				lock.unlock();
+				m_update(m_bufs[m_tail].data(), m_lens[m_tail]);
+				lock.lock();
+
+				m_tail = (m_tail + 1) % NR_BUFS;
+				m_count--;
+				m_cond.notify_all();
+			}
+		}
+
+		std::vector<std::vector<uint8_t> > m_bufs;
+		std::vector<size_t> m_lens;
+		unsigned int m_head;
+		unsigned int m_tail;
+		unsigned int m_count;
+		bool m_stop;
+		UpdateFn m_update;
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::thread m_thread;
+	};
+
+	//
+	// Translation prefetcher state, req_* holds the latest requested
+	// window and addr / end the window being translated (while busy is
+	// set). Each thread walking buffers has its own prefetcher so that
+	// concurrent walks do not overwrite each other's windows.
+	//
+	struct Prefetcher
+	{
+		Prefetcher() :
+			req_addr(0),
+			req_end(0),
+			addr(0),
+			end(0),
+			busy(false)
+		{}
+
+		sc_event req_event;
+		sc_event done_event;
+
+		uint64_t req_addr;
+		uint64_t req_end;
+		uint64_t addr;
+		uint64_t end;
+		bool busy;
+	};
+
+	//
+	// State used by a thread processing jobs: a hashing pipeline, a set
+	// of digest engines (the engines hold the state of the ongoing
+	// computation so they can not be shared between threads), a bounce
+	// buffer for copies and a translation prefetcher.
+	//
+	struct JobContext
+	{
+		JobContext() :
+			buf(HashPipeline::BUF_SIZE)
+		{
+			unsigned int algo;
+
+			for (algo = 0; algo < digest_engine::NR_ALGOS; algo++) {
+				engines.push_back(digest_engine_create(algo));
+			}
+		}
+
+		~JobContext()
+		{
+			unsigned int i;
+
+			for (i = 0; i < engines.size(); i++) {
+				delete engines[i];
+			}
+		}
+
+		HashPipeline hash_pipe;
+		std::vector<digest_engine *> engines;
+		std::vector<uint8_t> buf;
+		Prefetcher prefetcher;
+	};
+
+	//
+	// Job queue entries, placed in host memory (little endian). The
+	// submission queue holds JobDescriptors and the completion queue
+	// JobCompletions. Both sizes are powers of two so that entries never
+	// cross a page.
+	//
+	struct JobDescriptor {
+		// JOB_OP_X, the digest algorithm in the R_CTRL_ALGO field
+		uint32_t ctrl;
+		uint32_t length;
+		uint64_t src_addr;
+		uint64_t dst_addr;
+		// Returned in the completion
+		uint64_t tag;
+	};
+
+	struct JobCompletion {
+		// The descriptor's tag, or the submission queue index (free
+		// running, as R_SQ_HEAD) if the descriptor could not be
+		// fetched
+		uint64_t tag;
+		// R_STATUS_X bits
+		uint32_t status;
+		uint32_t digest_length;
+		uint8_t digest[digest_engine::MAX_DIGEST_LENGTH];
+		uint8_t reserved[16];
+	};
+
+	//
+	// Pool of generic payloads with an attached atsattr_extension, used
+	// for the DMA and ATS requests. The payloads are allocated on first
+	// use (the pool grows to the number of requests in flight at the same
+	// time) and are reused afterwards, so the requests do not allocate.
+	// The extensions stay attached and are released together with their
+	// payload.
+	//
+	class PayloadPool
+	{
+	public:
+		struct Payload {
+			tlm::tlm_generic_payload gp;
+			atsattr_extension *atsattr;
+		};
+
+		~PayloadPool()
+		{
+			unsigned int i;
+
+			for (i = 0; i < m_free.size(); i++) {
+				delete m_free[i];
+			}
+		}
+
+		//
+		// Returns a payload, reset and with its extension cleared.
+		// Hand it back with put() after the transaction.
+		//
+		Payload *get()
+		{
+			Payload *p;
+
+			if (m_free.empty()) {
+				p = new Payload();
+				p->atsattr = new atsattr_extension();
+				p->gp.set_extension(p->atsattr);
+			} else {
+				p = m_free.back();
+				m_free.pop_back();
+			}
+
+			p->gp.set_address(0);
+			p->gp.set_data_ptr(NULL);
+			p->gp.set_data_length(0);
+			p->gp.set_streaming_width(0);
+			p->gp.set_byte_enable_ptr(NULL);
+			p->gp.set_byte_enable_length(0);
+			p->gp.set_dmi_allowed(false);
+			p->gp.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+
+			p->atsattr->set_attributes(0);
+			p->atsattr->set_result(atsattr_extension::RESULT_OK);
+			p->atsattr->set_length(0);
+
+			return p;
+		}
+
+		void put(Payload *p)
+		{
+			m_free.push_back(p);
+		}
+
+	private:
+		std::vector<Payload *> m_free;
+	};
+
 	//
 	// Address translation cache
 	//
+	// The ATC is organized as 'nr_sets' sets with 'nr_ways' entries each
+	// (nr_sets == 1 gives a fully associative cache). A translation is
+	// placed in the set selected by its virtual page number (at the
+	// granularity of the translation) and, when the set is full, a victim
+	// is selected with the configured replacement policy. The translations
+	// are also indexed on their virtual start address for the lookups.
+	//
 	class ATC {
 	public:
+		enum Policy {
+			POLICY_LRU,
+			POLICY_CLOCK,
+		};
+
+		struct Stats {
+			uint64_t hits;
+			uint64_t misses;
+			uint64_t evictions;
+			uint64_t invalidations;
+			uint64_t ats_requests;
+		};
+
 		tlm_utils::simple_initiator_socket<pci_device_base> &m_ats_req;
+		PayloadPool &m_pool;
+
+		ATC(tlm_utils::simple_initiator_socket<pci_device_base> &ats_req,
+			PayloadPool &pool,
+			unsigned int nr_entries, unsigned int nr_ways,
+			Policy policy):
+			m_ats_req(ats_req),
+			m_pool(pool),
+			m_nr_ways(nr_ways),
+			m_nr_sets(nr_entries / nr_ways),
+			m_policy(policy),
+			m_entries(m_nr_sets * m_nr_ways),
+			m_clock_hand(m_nr_sets, 0),
+			m_tick(0)
+		{
+			assert(nr_ways > 0 && m_nr_sets > 0);
+			assert((nr_entries % nr_ways) == 0);
 
-		ATC(tlm_utils::simple_initiator_socket<pci_device_base> &ats_req):
-			m_ats_req(ats_req)
-		{}
+			clear_stats();
+		}
 
 		//
-		// Transmit ATS translation requests for the region.
+		// Transmit ATS translation requests for the region. Each request
+		// asks for the remaining part of the region so that the host can
+		// answer with translations covering multiple pages (the length of
+		// the returned translation is found in atsattr->get_length()).
+		//
+		// The region is capped at what the ATC can hold (get_reach()),
+		// translating more would evict the first translations before
+		// they are used and the next miss would request them again. The
+		// rest of a larger region is left to later misses and the
+		// prefetcher.
 		//
 		// virt_addr: region start address
 		// length: region length
 		//
-		void do_ats_req(uint64_t virt_addr, uint64_t length)
+		// returns: true if the (capped) region was translated
+		//
+		bool do_ats_req(uint64_t virt_addr, uint64_t length)
 		{
+			uint64_t end;
+
+			if (length > get_reach()) {
+				length = get_reach();
+			}
+			end = virt_addr + length;
+
 			//
 			// Make sure to have the translations naturally
 			// aligned to SZ_4K size
 			//
-			length += virt_addr & (SZ_4K-1);
 			virt_addr &= ~(SZ_4K-1);
 
-                        while (length) {
-				atsattr_extension *atsattr = new atsattr_extension();
+			while (virt_addr < end) {
+				PayloadPool::Payload *p = m_pool.get();
+				atsattr_extension *atsattr = p->atsattr;
+				tlm::tlm_generic_payload &gp = p->gp;
 				sc_time delay(SC_ZERO_TIME);
-				tlm::tlm_generic_payload gp;
 				uint64_t attr = atsattr_extension::ATTR_WRITE |
 						atsattr_extension::ATTR_READ |
 						atsattr_extension::ATTR_EXEC;
+				uint64_t req_len = end - virt_addr;
 
-				gp.set_extension(atsattr);
 				gp.set_command(tlm::TLM_IGNORE_COMMAND);
 
 				//
 				// Set the ATS translation request's region start
-				// address and attributes
+				// address, length and attributes
 				//
 				gp.set_address(virt_addr);
 				atsattr->set_attributes(attr);
+				atsattr->set_length((req_len + SZ_4K - 1) & ~(SZ_4K-1));
 
 				//
 				// Transmit the ATS request
 				//
 				m_ats_req->b_transport(gp, delay);
+				m_stats.ats_requests++;
 
-				if (gp.get_response_status() == tlm::TLM_OK_RESPONSE &&
-					atsattr->get_result() == atsattr_extension::RESULT_OK) {
-
+				if (gp.get_response_status() != tlm::TLM_OK_RESPONSE ||
+					atsattr->get_result() != atsattr_extension::RESULT_OK ||
+					atsattr->get_length() == 0) {
 					//
-					// Make sure to have the address
-					// aligned to the returned length
+					// Translation failed
 					//
+					m_pool.put(p);
+					return false;
+				}
+
+				//
+				// Translations of a power of two size (4 KiB,
+				// 2 MiB, 1 GiB, ...) are naturally aligned, make
+				// sure to have the address aligned to the
+				// returned length
+				//
+				if (!(atsattr->get_length() &
+					(atsattr->get_length() - 1))) {
 					virt_addr &= ~(atsattr->get_length()-1);
+				}
 
-					//
-					// Translation succeded, add into the ATC cache
-					//
-					m_regions.push_back(MemoryRegion(virt_addr, gp.get_address(),
-									atsattr->get_length(),
-									atsattr->get_attributes()));
-
-					if (atsattr->get_length() > length) {
-						//
-						// Last translations has been received
-						//
-						break;
-					}
+				//
+				// Translation succeded, add into the ATC cache
+				//
+				insert(MemoryRegion(virt_addr, gp.get_address(),
+						atsattr->get_length(),
+						atsattr->get_attributes()));
 
-					length -= atsattr->get_length();
-					virt_addr += atsattr->get_length();
-				}
+				virt_addr += atsattr->get_length();
+				m_pool.put(p);
 			}
+			return true;
+		}
+
+		//
+		// Check if the ATC contains a translation for a virtual address
+		// without touching the statistics or the replacement state.
+		//
+		bool peek(uint64_t virt_addr)
+		{
+			return find(virt_addr) >= 0;
 		}
 
 		//
 		// Check if the ATC contains a translation for a virtual address.
+		// The lookup is accounted as a hit or a miss in the ATC
+		// statistics and refreshes the replacement state of the entry.
 		//
 		// virt_addr: the virtual address to perform the lookup for
 		//
@@ -164,16 +538,36 @@ private:
 		//
 		bool contains(uint64_t virt_addr)
 		{
-			std::vector<MemoryRegion>::iterator it;
+			int idx = find(virt_addr);
+
+			if (idx < 0) {
+				m_stats.misses++;
+				return false;
+			}
 
-			for (it = m_regions.begin(); it != m_regions.end(); it++) {
-				MemoryRegion &r = (*it);
+			m_stats.hits++;
+			touch(m_entries[idx]);
+			return true;
+		}
 
-				if (r.contains(virt_addr)) {
-					return true;
-				}
+		//
+		// Get the end of the cached translation containing a virtual
+		// address (the lookup is not accounted in the statistics).
+		//
+		// virt_addr: the address to perform the lookup for
+		//
+		// returns: the end address (exclusive) of the translation, 0 if
+		//          the ATC does not contain the address
+		//
+		uint64_t get_end(uint64_t virt_addr)
+		{
+			int idx = find(virt_addr);
+
+			if (idx < 0) {
+				return 0;
 			}
-			return false;
+			return m_entries[idx].region.get_virt_addr() +
+				m_entries[idx].region.get_length();
 		}
 
 		//
@@ -185,16 +579,12 @@ private:
 		//
 		uint64_t virt_to_phys(uint64_t virt_addr)
 		{
-			std::vector<MemoryRegion>::iterator it;
+			int idx = find(virt_addr);
 
-			for (it = m_regions.begin(); it != m_regions.end(); it++) {
-				MemoryRegion &r = (*it);
-
-				if (r.contains(virt_addr)) {
-					return r.virt_to_phys(virt_addr);
-				}
+			if (idx < 0) {
+				return 0;
 			}
-			return 0;
+			return m_entries[idx].region.virt_to_phys(virt_addr);
 		}
 
 		//
@@ -207,16 +597,12 @@ private:
 		//
 		bool test_attr(uint64_t virt_addr, uint64_t attr)
 		{
-			std::vector<MemoryRegion>::iterator it;
-
-			for (it = m_regions.begin(); it != m_regions.end(); it++) {
-				MemoryRegion &r = (*it);
+			int idx = find(virt_addr);
 
-				if (r.contains(virt_addr)) {
-					return r.get_attributes() & attr;
-				}
+			if (idx < 0) {
+				return false;
 			}
-			return false;
+			return m_entries[idx].region.get_attributes() & attr;
 		}
 
 		//
@@ -227,31 +613,195 @@ private:
 		//
 		void invalidate(uint64_t virt_addr, uint64_t length)
 		{
+			m_stats.invalidations += remove_range(virt_addr, length);
+		}
+
+		const Stats &get_stats() { return m_stats; }
+
+		void clear_stats() { memset(&m_stats, 0, sizeof(m_stats)); }
+
+		unsigned int get_nr_sets() { return m_nr_sets; }
+		unsigned int get_nr_ways() { return m_nr_ways; }
+
+		//
+		// The range the ATC can hold in 4 KiB translations.
+		//
+		uint64_t get_reach()
+		{
+			return static_cast<uint64_t>(m_nr_sets) * m_nr_ways * SZ_4K;
+		}
+
+	private:
+		struct Entry {
+			Entry() :
+				region(0, 0, 0, 0),
+				valid(false),
+				ref(false),
+				last_use(0)
+			{}
+
+			MemoryRegion region;
+			bool valid;
+
+			// CLOCK reference bit
+			bool ref;
+
+			// LRU time stamp
+			uint64_t last_use;
+		};
+
+		//
+		// Returns the index of the entry containing virt_addr or -1.
+		//
+		int find(uint64_t virt_addr)
+		{
+			std::map<uint64_t, unsigned int>::iterator it;
+
+			it = m_index.upper_bound(virt_addr);
+			if (it == m_index.begin()) {
+				return -1;
+			}
+			it--;
+
+			if (!m_entries[it->second].region.contains(virt_addr)) {
+				return -1;
+			}
+			return it->second;
+		}
+
+		//
+		// Remove all entries overlapping [virt_addr, virt_addr + length).
+		// Entries never overlap each other so the overlapping ones are
+		// found through the index: the entry starting at or before
+		// virt_addr followed by the ones starting inside the range.
+		//
+		// virt_addr: the start address of the range
+		// length: the length of the range (saturates at the end of the
+		//         address space)
+		//
+		// returns: the number of entries removed
+		//
+		unsigned int remove_range(uint64_t virt_addr, uint64_t length)
+		{
+			std::map<uint64_t, unsigned int>::iterator it;
+			uint64_t last = virt_addr + length - 1;
+			unsigned int nr_removed = 0;
 
-			std::vector<MemoryRegion>::iterator it;
+			if (length == 0) {
+				return 0;
+			}
+			if (last < virt_addr) {
+				last = UINT64_MAX;
+			}
 
-			for (it = m_regions.begin(); it != m_regions.end();) {
-				MemoryRegion &r = (*it);
-				uint64_t region_start = r.get_virt_addr();
-				uint64_t region_end = region_start +
-							r.get_length() - 1;
+			it = m_index.upper_bound(virt_addr);
+			if (it != m_index.begin()) {
+				std::map<uint64_t, unsigned int>::iterator prev = it;
+				MemoryRegion *r;
 
-				if (in_range(region_start, virt_addr, length) ||
-					in_range(region_end, virt_addr, length)) {
-					m_regions.erase(it);
-				} else {
-					it++;
+				prev--;
+				r = &m_entries[prev->second].region;
+				if (r->get_virt_addr() + r->get_length() > virt_addr) {
+					it = prev;
 				}
 			}
+
+			while (it != m_index.end() && it->first <= last) {
+				m_entries[it->second].valid = false;
+				m_index.erase(it++);
+				nr_removed++;
+			}
+			return nr_removed;
 		}
 
-	private:
-		bool in_range(uint64_t addr, uint64_t start, uint64_t len)
+		void touch(Entry &e)
+		{
+			e.ref = true;
+			e.last_use = ++m_tick;
+		}
+
+		unsigned int set_of(MemoryRegion &r)
 		{
-			return addr >= start && addr < (start + len);
+			uint64_t len = r.get_length() ? r.get_length() : SZ_4K;
+
+			return (r.get_virt_addr() / len) % m_nr_sets;
+		}
+
+		//
+		// Select the way to replace in a set. Invalid ways are
+		// always used first.
+		//
+		unsigned int select_victim(unsigned int set)
+		{
+			unsigned int base = set * m_nr_ways;
+			unsigned int victim = 0;
+			unsigned int i;
+
+			for (i = 0; i < m_nr_ways; i++) {
+				if (!m_entries[base + i].valid) {
+					return base + i;
+				}
+			}
+
+			if (m_policy == POLICY_CLOCK) {
+				unsigned int &hand = m_clock_hand[set];
+
+				while (m_entries[base + hand].ref) {
+					m_entries[base + hand].ref = false;
+					hand = (hand + 1) % m_nr_ways;
+				}
+				victim = hand;
+				hand = (hand + 1) % m_nr_ways;
+			} else {
+				for (i = 1; i < m_nr_ways; i++) {
+					if (m_entries[base + i].last_use <
+						m_entries[base + victim].last_use) {
+						victim = i;
+					}
+				}
+			}
+			return base + victim;
+		}
+
+		void insert(const MemoryRegion &region)
+		{
+			MemoryRegion r(region);
+			unsigned int idx;
+
+			//
+			// Drop the translations the new one replaces (a refresh
+			// of the same range or a larger translation covering
+			// previously cached pages) so entries never overlap,
+			// these count as evictions.
+			//
+			m_stats.evictions += remove_range(r.get_virt_addr(),
+							r.get_length());
+
+			idx = select_victim(set_of(r));
+			if (m_entries[idx].valid) {
+				m_index.erase(m_entries[idx].region.get_virt_addr());
+				m_stats.evictions++;
+			}
+
+			m_entries[idx].region = r;
+			m_entries[idx].valid = true;
+			touch(m_entries[idx]);
+
+			m_index[r.get_virt_addr()] = idx;
 		}
 
-		std::vector<MemoryRegion> m_regions;
+		unsigned int m_nr_ways;
+		unsigned int m_nr_sets;
+		Policy m_policy;
+
+		std::vector<Entry> m_entries;
+		std::vector<unsigned int> m_clock_hand;
+		uint64_t m_tick;
+
+		// Virtual start address to entry index
+		std::map<uint64_t, unsigned int> m_index;
+
+		Stats m_stats;
 	};
 
 	enum {
@@ -268,6 +818,50 @@ private:
 		R_MD5_RESULT_1 = 0x1C,
 		R_MD5_RESULT_2 = 0x20,
 		R_MD5_RESULT_3 = 0x24,
+		R_ATC_HITS_LSB = 0x28,
+		R_ATC_HITS_MSB = 0x2C,
+		R_ATC_MISSES_LSB = 0x30,
+		R_ATC_MISSES_MSB = 0x34,
+		R_ATC_EVICTIONS_LSB = 0x38,
+		R_ATC_EVICTIONS_MSB = 0x3C,
+		R_ATC_INVALIDATIONS_LSB = 0x40,
+		R_ATC_INVALIDATIONS_MSB = 0x44,
+		R_ATC_GEOMETRY = 0x48,
+		R_ATC_PREFETCH = 0x4C,
+		R_DIGEST_LENGTH = 0x50,
+
+		//
+		// Job queues
+		//
+		R_SQ_BASE_LSB = 0x54,
+		R_SQ_BASE_MSB = 0x58,
+		R_CQ_BASE_LSB = 0x5C,
+		R_CQ_BASE_MSB = 0x60,
+		R_QUEUE_SIZE = 0x64,
+		R_SQ_TAIL = 0x68,
+		R_SQ_HEAD = 0x6C,
+		R_CQ_HEAD = 0x70,
+		R_QUEUE_WORKERS = 0x74,
+		R_IRQ_ENABLE = 0x78,
+
+		//
+		// Digest result (R_DIGEST_0 - R_DIGEST_3 alias the
+		// R_MD5_RESULT_X registers)
+		//
+		R_DIGEST_0 = 0x80,
+		R_DIGEST_7 = 0x9C,
+
+		//
+		// Destination address of copies and fills
+		//
+		R_DST_ADDR_LSB = 0xA0,
+		R_DST_ADDR_MSB = 0xA4,
+
+		//
+		// ATS translation requests transmitted
+		//
+		R_ATS_REQUESTS_LSB = 0xA8,
+		R_ATS_REQUESTS_MSB = 0xAC,
 
 		//
 		// R_CTRL bits
@@ -276,12 +870,44 @@ private:
 		R_CTRL_READ = 1 << 1,
 		R_CTRL_WRITE = 1 << 2,
 		R_CTRL_MD5SUM = 1 << 3,
+		R_CTRL_DIGEST = R_CTRL_MD5SUM,
+		R_CTRL_ATC_STATS_CLEAR = 1 << 4,
+		R_CTRL_COPY = 1 << 5,
+		R_CTRL_FILL = 1 << 6,
+
+		//
+		// R_CTRL digest algorithm select field (see
+		// digest_engine::ALGO_X), used with R_CTRL_DIGEST
+		//
+		R_CTRL_ALGO_SHIFT = 8,
+		R_CTRL_ALGO_MASK = 0xF << R_CTRL_ALGO_SHIFT,
 
 		//
 		// R_STATUS bits
 		//
 		R_STATUS_DONE = 1 << 0,
 		R_STATUS_ERR = 1 << 1,
+
+		//
+		// MSI-X vectors, enabled with the corresponding bit
+		// (1 << vector) in R_IRQ_ENABLE
+		//
+		IRQ_DONE = 0,
+		IRQ_QUEUE = 1,
+
+		//
+		// JobDescriptor ctrl operations
+		//
+		JOB_OP_MASK = 0xFF,
+		JOB_OP_DIGEST = 1,
+		JOB_OP_COPY = 2,
+		// The fill pattern is in the low 32 bits of src_addr
+		JOB_OP_FILL = 3,
+
+		//
+		// Maximum number of entries in the queues
+		//
+		QUEUE_MAX_SIZE = 4096,
 	};
 
 	//
@@ -332,27 +958,100 @@ private:
 				v = regs.addr_msb;
 				break;
 			case R_MD5_RESULT_0:
-				v = regs.md5_result0;
-				break;
 			case R_MD5_RESULT_1:
-				v = regs.md5_result1;
-				break;
 			case R_MD5_RESULT_2:
-				v = regs.md5_result2;
-				break;
 			case R_MD5_RESULT_3:
-				v = regs.md5_result3;
+				v = regs.digest[(addr - R_MD5_RESULT_0) / 4];
 				break;
-			default:
+			case R_ATC_HITS_LSB:
+				v = m_atc.get_stats().hits;
 				break;
-			}
-
-			memcpy(data, &v, len);
-		} else if (cmd == tlm::TLM_WRITE_COMMAND) {
-
-			memcpy(&v, data, len);
-
-			switch (addr) {
+			case R_ATC_HITS_MSB:
+				v = m_atc.get_stats().hits >> 32;
+				break;
+			case R_ATC_MISSES_LSB:
+				v = m_atc.get_stats().misses;
+				break;
+			case R_ATC_MISSES_MSB:
+				v = m_atc.get_stats().misses >> 32;
+				break;
+			case R_ATC_EVICTIONS_LSB:
+				v = m_atc.get_stats().evictions;
+				break;
+			case R_ATC_EVICTIONS_MSB:
+				v = m_atc.get_stats().evictions >> 32;
+				break;
+			case R_ATC_INVALIDATIONS_LSB:
+				v = m_atc.get_stats().invalidations;
+				break;
+			case R_ATC_INVALIDATIONS_MSB:
+				v = m_atc.get_stats().invalidations >> 32;
+				break;
+			case R_ATC_GEOMETRY:
+				v = (m_atc.get_nr_sets() & 0xFFFF) |
+					(m_atc.get_nr_ways() << 16);
+				break;
+			case R_ATC_PREFETCH:
+				v = m_prefetch_pages;
+				break;
+			case R_DIGEST_LENGTH:
+				v = regs.digest_length;
+				break;
+			case R_SQ_BASE_LSB:
+				v = regs.sq_base_lsb;
+				break;
+			case R_SQ_BASE_MSB:
+				v = regs.sq_base_msb;
+				break;
+			case R_CQ_BASE_LSB:
+				v = regs.cq_base_lsb;
+				break;
+			case R_CQ_BASE_MSB:
+				v = regs.cq_base_msb;
+				break;
+			case R_QUEUE_SIZE:
+				v = regs.queue_size;
+				break;
+			case R_SQ_TAIL:
+				v = regs.sq_tail;
+				break;
+			case R_SQ_HEAD:
+				v = regs.sq_head;
+				break;
+			case R_CQ_HEAD:
+				v = regs.cq_head;
+				break;
+			case R_QUEUE_WORKERS:
+				v = m_workers.size();
+				break;
+			case R_IRQ_ENABLE:
+				v = regs.irq_enable;
+				break;
+			case R_DST_ADDR_LSB:
+				v = regs.dst_addr_lsb;
+				break;
+			case R_DST_ADDR_MSB:
+				v = regs.dst_addr_msb;
+				break;
+			case R_ATS_REQUESTS_LSB:
+				v = m_atc.get_stats().ats_requests;
+				break;
+			case R_ATS_REQUESTS_MSB:
+				v = m_atc.get_stats().ats_requests >> 32;
+				break;
+			default:
+				if (addr >= R_DIGEST_0 && addr <= R_DIGEST_7) {
+					v = regs.digest[(addr - R_DIGEST_0) / 4];
+				}
+				break;
+			}
+
+			memcpy(data, &v, len);
+		} else if (cmd == tlm::TLM_WRITE_COMMAND) {
+
+			memcpy(&v, data, len);
+
+			switch (addr) {
 			case R_CTRL:
 				if (v & R_CTRL_TRANSLATE) {
 					m_ats_req_event.notify();
@@ -360,8 +1059,14 @@ private:
 					m_read_event.notify();
 				} else if (v & R_CTRL_WRITE) {
 					m_write_event.notify();
-				} else if (v & R_CTRL_MD5SUM) {
-					m_md5_event.notify();
+				} else if (v & R_CTRL_DIGEST) {
+					regs.ctrl = v;
+					m_digest_event.notify();
+				} else if (v & R_CTRL_ATC_STATS_CLEAR) {
+					m_atc.clear_stats();
+				} else if (v & (R_CTRL_COPY | R_CTRL_FILL)) {
+					regs.ctrl = v;
+					m_bulk_event.notify();
 				}
 				break;
 			case R_ADDR:
@@ -379,6 +1084,54 @@ private:
 			case R_MSB_ADDR:
 				regs.addr_msb = v;
 				break;
+			case R_ATC_PREFETCH:
+				m_prefetch_pages = v;
+				break;
+			case R_SQ_BASE_LSB:
+				regs.sq_base_lsb = v;
+				break;
+			case R_SQ_BASE_MSB:
+				regs.sq_base_msb = v;
+				break;
+			case R_CQ_BASE_LSB:
+				regs.cq_base_lsb = v;
+				break;
+			case R_CQ_BASE_MSB:
+				regs.cq_base_msb = v;
+				break;
+			case R_QUEUE_SIZE:
+				//
+				// (Re)initializes the queues, 0 or an invalid
+				// size disables them
+				//
+				if (v > QUEUE_MAX_SIZE || (v & (v - 1))) {
+					v = 0;
+				}
+				regs.queue_size = v;
+				regs.sq_head = 0;
+				regs.sq_tail = 0;
+				regs.cq_head = 0;
+				m_cq_tail = 0;
+				m_queue_gen++;
+				m_cq_doorbell_event.notify();
+				break;
+			case R_SQ_TAIL:
+				regs.sq_tail = v;
+				m_sq_doorbell_event.notify();
+				break;
+			case R_CQ_HEAD:
+				regs.cq_head = v;
+				m_cq_doorbell_event.notify();
+				break;
+			case R_IRQ_ENABLE:
+				regs.irq_enable = v;
+				break;
+			case R_DST_ADDR_LSB:
+				regs.dst_addr_lsb = v;
+				break;
+			case R_DST_ADDR_MSB:
+				regs.dst_addr_msb = v;
+				break;
 			default:
 				break;
 			}
@@ -422,22 +1175,23 @@ err:
 	//
 	void phys_read(uint64_t phys_addr, uint8_t *data, unsigned long len)
 	{
-		atsattr_extension *atsattr = new atsattr_extension();
+		PayloadPool::Payload *p = m_pool.get();
+		tlm::tlm_generic_payload &gp = p->gp;
 		sc_time delay(SC_ZERO_TIME);
-		tlm::tlm_generic_payload gp;
 
-		gp.set_extension(atsattr);
 		gp.set_command(tlm::TLM_READ_COMMAND);
 		gp.set_address(phys_addr);
 		gp.set_data_ptr(data);
 		gp.set_data_length(len);
 		gp.set_streaming_width(len);
 
-		atsattr->set_attributes(atsattr_extension::ATTR_PHYS_ADDR);
+		p->atsattr->set_attributes(atsattr_extension::ATTR_PHYS_ADDR);
 
 		dma->b_transport(gp, delay);
 
 		assert(gp.get_response_status() == tlm::TLM_OK_RESPONSE);
+
+		m_pool.put(p);
 	}
 
 
@@ -458,42 +1212,222 @@ err:
 	}
 
 	//
-	// Write the 4 bytes in regs.value to an already translated (physical)
-	// address.
+	// Write len bytes from the provided data buffer to an already
+	// translated (physical) address.
 	//
 	// phys_addr: The physical address to write to
+	// data: The data buffer holding the data to write
+	// len: The amount of data to write
 	//
-	void phys_write32(uint64_t phys_addr)
+	void phys_write(uint64_t phys_addr, uint8_t *data, unsigned long len)
 	{
-		atsattr_extension *atsattr = new atsattr_extension();
+		PayloadPool::Payload *p = m_pool.get();
+		tlm::tlm_generic_payload &gp = p->gp;
 		sc_time delay(SC_ZERO_TIME);
-		tlm::tlm_generic_payload gp;
-		uint32_t data = regs.value;
-		uint8_t *d = reinterpret_cast<uint8_t*>(&data);
 
-		gp.set_extension(atsattr);
 		gp.set_command(tlm::TLM_WRITE_COMMAND);
 		gp.set_address(phys_addr);
-		gp.set_data_ptr(d);
-		gp.set_data_length(4);
-		gp.set_streaming_width(4);
+		gp.set_data_ptr(data);
+		gp.set_data_length(len);
+		gp.set_streaming_width(len);
 
-		atsattr->set_attributes(atsattr_extension::ATTR_PHYS_ADDR);
+		p->atsattr->set_attributes(atsattr_extension::ATTR_PHYS_ADDR);
 
 		dma->b_transport(gp, delay);
 
 		assert(gp.get_response_status() == tlm::TLM_OK_RESPONSE);
+
+		m_pool.put(p);
+	}
+
+	//
+	// Write the 4 bytes in regs.value to an already translated (physical)
+	// address.
+	//
+	// phys_addr: The physical address to write to
+	//
+	void phys_write32(uint64_t phys_addr)
+	{
+		uint32_t data = regs.value;
+
+		phys_write(phys_addr, reinterpret_cast<uint8_t*>(&data),
+				sizeof(data));
 	}
 
 	enum { SZ_4K = 4096 };
 
+	//
+	// Make sure the ATC contains a translation for virt_addr. On a miss
+	// the translations for the range [virt_addr, virt_addr + length) are
+	// requested in one go (if the thread's prefetcher is already busy
+	// requesting the translation the thread waits for it instead of
+	// issuing a second ATS request).
+	//
+	// pf: the calling thread's prefetcher
+	// virt_addr: the virtual address to look up
+	// length: the range to translate on a miss
+	//
+	// returns: true if the ATC contains the translation
+	//
+	bool translate(Prefetcher &pf, uint64_t virt_addr, uint64_t length)
+	{
+		if (m_atc.contains(virt_addr)) {
+			return true;
+		}
+
+		while (pf.busy && virt_addr >= pf.addr && virt_addr < pf.end) {
+			wait(pf.done_event);
+
+			if (m_atc.peek(virt_addr)) {
+				return true;
+			}
+		}
+
+		return m_atc.do_ats_req(virt_addr, length);
+	}
+
+	//
+	// Ask a prefetcher to request the translations for the next
+	// m_prefetch_pages pages following virt_addr.
+	//
+	// pf: the calling thread's prefetcher
+	// virt_addr: the address following the data currently consumed
+	// limit: the end of the region the consumer is walking
+	//
+	void prefetch(Prefetcher &pf, uint64_t virt_addr, uint64_t limit)
+	{
+		uint64_t end = virt_addr + m_prefetch_pages * SZ_4K;
+
+		if (m_prefetch_pages == 0 || virt_addr >= limit) {
+			return;
+		}
+		if (end > limit) {
+			end = limit;
+		}
+
+		pf.req_addr = virt_addr;
+		pf.req_end = end;
+		pf.req_event.notify();
+	}
+
+	//
+	// One of these threads runs per prefetcher. It waits for the
+	// prefetcher's 'req_event' which is notified by the thread consuming
+	// translations (see prefetch above). After
+	// receiving the event the thread requests the translations for the
+	// missing pages in the prefetch window, coalescing consecutive
+	// missing pages into multi-page ATS requests, so that the
+	// translations are available when the consumer reaches the pages.
+	//
+	// pf: the prefetcher to serve
+	//
+	void prefetch_thread(Prefetcher &pf)
+	{
+		while (true) {
+			uint64_t addr;
+
+			wait(pf.req_event);
+
+			while (pf.req_end) {
+				pf.addr = pf.req_addr & ~(SZ_4K-1);
+				pf.end = pf.req_end;
+				pf.req_end = 0;
+				pf.busy = true;
+
+				addr = pf.addr;
+				while (addr < pf.end) {
+					uint64_t run_end = addr;
+					uint64_t end = m_atc.get_end(addr);
+
+					if (end) {
+						// Skip the cached translation
+						addr = end;
+						continue;
+					}
+
+					while (run_end < pf.end &&
+						!m_atc.peek(run_end)) {
+						run_end += SZ_4K;
+					}
+
+					if (!m_atc.do_ats_req(addr, run_end - addr)) {
+						// Leave it to the consumer
+						break;
+					}
+					addr = run_end;
+				}
+
+				pf.busy = false;
+				pf.done_event.notify();
+			}
+		}
+	}
+
+	//
+	// Start the prefetch thread serving pf
+	//
+	// pf: the prefetcher to serve
+	//
+	void spawn_prefetcher(Prefetcher &pf)
+	{
+		sc_spawn(sc_bind(&pcie_acc::prefetch_thread, this, sc_ref(pf)));
+	}
+
+	//
+	// Signal an MSI-X vector (if enabled in R_IRQ_ENABLE). Notifications
+	// arriving before the vector's irq thread runs are merged into a
+	// single interrupt, the ones arriving during a pulse give a new one.
+	//
+	// vec: the vector (IRQ_X)
+	//
+	void raise_irq(unsigned int vec)
+	{
+		if (regs.irq_enable & (1 << vec)) {
+			m_irq_pending[vec] = true;
+			m_irq_event[vec].notify();
+		}
+	}
+
+	//
+	// Complete an operation started through R_CTRL.
+	//
+	// status: the R_STATUS_X bits to set
+	//
+	void done(uint32_t status)
+	{
+		regs.status = status;
+		raise_irq(IRQ_DONE);
+	}
+
+	//
+	// Pulses the irq line of an MSI-X vector when notified through
+	// raise_irq, one of these threads is spawned per vector.
+	//
+	// vec: the vector (IRQ_X)
+	//
+	void irq_thread(unsigned int vec)
+	{
+		while (true) {
+			if (!m_irq_pending[vec]) {
+				wait(m_irq_event[vec]);
+			}
+			m_irq_pending[vec] = false;
+
+			irq[vec].write(true);
+			wait(10, SC_NS);
+			irq[vec].write(false);
+		}
+	}
+
 	//
 	// This thread waits for an 'm_ats_req_event' which is notified when
 	// the R_CTRL register is written with the value R_CTRL_TRANSLATE.
 	// After receiving the event the thread will let the ATC perform ATS
 	// translation requests for the address range starting at address in
 	// the registers R_ADDR_MSB and R_ADDR_LSB and with the length in
-	// programmed into R_LENGTH. The translation is done in SZ_4K sizes.
+	// programmed into R_LENGTH. Missing translations are requested with
+	// multi-page ATS requests covering the prefetch window (at least a
+	// page), the window following them is handed to the prefetcher.
 	//
 	// After the translation has completed R_STATUS_DONE is set in the
 	// R_STATUS register.
@@ -502,29 +1436,42 @@ err:
 	{
 		while (true) {
 			uint64_t addr;
-			uint64_t length;
+			uint64_t end;
 
 			wait(m_ats_req_event);
 
 			addr = static_cast<uint64_t>(regs.addr_msb) << 32 |
 				regs.addr_lsb;
 
-			length = regs.length;
+			end = addr + regs.length;
+			addr &= ~(SZ_4K - 1);
 
-			for (; length > 0; length -= SZ_4K, addr += SZ_4K) {
-				uint64_t len = length;
+			//
+			// Step by the size of the translations
+			//
+			while (addr < end) {
+				uint64_t window = m_prefetch_pages * SZ_4K;
+				uint64_t next = 0;
 
-				if (!m_atc.contains(addr)) {
-					m_atc.do_ats_req(addr, SZ_4K);
+				if (window < SZ_4K) {
+					window = SZ_4K;
+				}
+				if (window > end - addr) {
+					window = end - addr;
 				}
 
-				if (len < SZ_4K) {
-					// Done
-					break;
+				if (translate(m_reg_prefetcher, addr, window)) {
+					next = m_atc.get_end(addr);
+					prefetch(m_reg_prefetcher, next, end);
+				}
+				if (next <= addr) {
+					// Failed, move on to the next page
+					next = addr + SZ_4K;
 				}
+				addr = next;
 			}
 
-			regs.status = R_STATUS_DONE;
+			done(R_STATUS_DONE);
 		}
 	}
 
@@ -550,9 +1497,7 @@ err:
 			virt_addr = static_cast<uint64_t>(regs.addr_msb) << 32 |
 					regs.addr_lsb;
 
-			if (!m_atc.contains(virt_addr)) {
-				m_atc.do_ats_req(virt_addr, SZ_4K);
-			}
+			translate(m_reg_prefetcher, virt_addr, SZ_4K);
 
 			if (m_atc.test_attr(virt_addr,
 					atsattr_extension::ATTR_READ)) {
@@ -562,7 +1507,7 @@ err:
 				phys_read32(phys_addr);
 			}
 
-			regs.status = R_STATUS_DONE;
+			done(R_STATUS_DONE);
 		}
 	}
 
@@ -588,9 +1533,7 @@ err:
 			virt_addr = static_cast<uint64_t>(regs.addr_msb) << 32 |
 					regs.addr_lsb;
 
-			if (!m_atc.contains(virt_addr)) {
-				m_atc.do_ats_req(virt_addr, SZ_4K);
-			}
+			translate(m_reg_prefetcher, virt_addr, SZ_4K);
 
 			if (m_atc.test_attr(virt_addr,
 					atsattr_extension::ATTR_WRITE)) {
@@ -600,90 +1543,488 @@ err:
 				phys_write32(phys_addr);
 			}
 
-			regs.status = R_STATUS_DONE;
+			done(R_STATUS_DONE);
 		}
 	}
 
 	//
-	// This thread waits for an 'm_md5_event' which is notified when
-	// the R_CTRL register is written with the value R_CTRL_MD5SUM.
-	// After receiving the event the thread will compute the MD5 message
-	// digest of the virtual address area starting from the address
-	// configured in the address registers R_ADDR_MSB and R_ADDR_LSB
-	// and with length configured in the R_LENGTH register. The
-	// result is placed to be read out in the R_MD5_RESULT_X registers.
+	// Find the physically contiguous run starting at virt_addr, the run
+	// is built from consecutive translated pages that map to adjacent
+	// physical addresses and allow the access (translations missing in
+	// the ATC are requested on the way).
 	//
-	// After the MD5 computation has completed R_STATUS_DONE is set in the
-	// R_STATUS register. In case of an error R_STATUS_ERR is notified.
+	// pf: the calling thread's prefetcher
+	// virt_addr: the start address of the run
+	// max_len: the maximum length of the run
+	// limit: the end of the region being walked (used for prefetching)
+	// attr: the access required (atsattr_extension::ATTR_READ or
+	//       atsattr_extension::ATTR_WRITE)
+	// phys_addr: the physical address of the run is returned here
+	//
+	// returns: the length of the run, 0 on a translation error
 	//
-	void md5_thread()
+	uint64_t contiguous_run(Prefetcher &pf, uint64_t virt_addr,
+				uint64_t max_len, uint64_t limit,
+				uint64_t attr, uint64_t *phys_addr)
 	{
-		while (true) {
-			unsigned char res[MD5_DIGEST_LENGTH];
-			uint8_t data[SZ_4K];
-			uint64_t virt_addr;
-			unsigned long len;
-			MD5_CTX ctx;
+		uint64_t run;
+
+		if (!translate(pf, virt_addr, SZ_4K) ||
+			!m_atc.test_attr(virt_addr, attr)) {
+			return 0;
+		}
 
-			wait(m_md5_event);
+		//
+		// Walk by translation, a huge page translation covers the
+		// whole run in one step
+		//
+		*phys_addr = m_atc.virt_to_phys(virt_addr);
+		run = m_atc.get_end(virt_addr) - virt_addr;
 
-			virt_addr = static_cast<uint64_t>(regs.addr_msb) << 32 |
-					regs.addr_lsb;
-			len = regs.length;
+		while (run < max_len) {
+			uint64_t next = virt_addr + run;
 
-			if (MD5_Init(&ctx) == 0) {
-				regs.status = R_STATUS_ERR | R_STATUS_DONE;
-				continue;
+			//
+			// Request the upcoming translations ahead of time
+			//
+			prefetch(pf, next, limit);
+
+			if (!translate(pf, next, SZ_4K) ||
+				!m_atc.test_attr(next, attr) ||
+				m_atc.virt_to_phys(next) != *phys_addr + run) {
+				break;
 			}
+			run += m_atc.get_end(next) - next;
+		}
+
+		prefetch(pf, virt_addr + run, limit);
+
+		return run < max_len ? run : max_len;
+	}
+
+	//
+	// Transfer len bytes between a virtual address range and a local
+	// buffer, using one DMA per physically contiguous run.
+	//
+	// pf: the calling thread's prefetcher
+	// cmd: tlm::TLM_READ_COMMAND or tlm::TLM_WRITE_COMMAND
+	// virt_addr: the start address of the virtual address range
+	// data: the local buffer
+	// len: the amount of data to transfer
+	//
+	// returns: true on success, false on a translation error
+	//
+	bool dma_virt(Prefetcher &pf, tlm::tlm_command cmd, uint64_t virt_addr,
+			uint8_t *data, uint64_t len)
+	{
+		uint64_t limit = virt_addr + len;
+		uint64_t attr = cmd == tlm::TLM_READ_COMMAND ?
+					atsattr_extension::ATTR_READ :
+					atsattr_extension::ATTR_WRITE;
+
+		while (len) {
+			uint64_t phys_addr;
+			uint64_t run;
+
+			run = contiguous_run(pf, virt_addr, len, limit, attr,
+						&phys_addr);
+			if (run == 0) {
+				return false;
+			}
+
+			if (cmd == tlm::TLM_READ_COMMAND) {
+				phys_read(phys_addr, data, run);
+			} else {
+				phys_write(phys_addr, data, run);
+			}
+
+			data += run;
+			virt_addr += run;
+			len -= run;
+		}
+		return true;
+	}
+
+	//
+	// Compute the message digest of a virtual address range.
+	//
+	// The computation is pipelined: the buffers of the context's hashing
+	// pipeline are filled with DMA reads of physically contiguous runs
+	// while the previously filled buffers are hashed on a host thread.
+	//
+	// ctx: the job context to use
+	// algo: the digest algorithm (digest_engine::ALGO_X)
+	// virt_addr: the start address of the range
+	// len: the length of the range
+	// digest: the digest is placed here
+	//         (digest_engine::MAX_DIGEST_LENGTH bytes, zero padded)
+	// digest_length: the length of the digest is returned here
+	//
+	// returns: true on success, false on an error
+	//
+	bool do_digest(JobContext &ctx, unsigned int algo, uint64_t virt_addr,
+			uint64_t len, uint8_t *digest, uint32_t *digest_length)
+	{
+		uint64_t limit = virt_addr + len;
+		digest_engine *engine;
+
+		if (algo >= ctx.engines.size() || !ctx.engines[algo]->init()) {
+			return false;
+		}
+		engine = ctx.engines[algo];
 
-			while (len) {
-				unsigned long md5_len;
+		ctx.hash_pipe.start([engine](const uint8_t *data, size_t len) {
+			engine->update(data, len);
+		});
+
+		while (len) {
+			uint8_t *buf = ctx.hash_pipe.get_buffer();
+			uint64_t buf_len = 0;
+
+			//
+			// Fill the buffer with DMA reads
+			//
+			while (len && buf_len < HashPipeline::BUF_SIZE) {
+				uint64_t max_len = HashPipeline::BUF_SIZE - buf_len;
 				uint64_t phys_addr;
-				uint64_t mask = (SZ_4K - 1);
+				uint64_t run;
 
-				if (!m_atc.contains(virt_addr)) {
-					m_atc.do_ats_req(virt_addr, len);
+				if (max_len > len) {
+					max_len = len;
 				}
 
-				if (!m_atc.test_attr(virt_addr,
-						atsattr_extension::ATTR_READ)) {
+				run = contiguous_run(ctx.prefetcher, virt_addr,
+						max_len, limit,
+						atsattr_extension::ATTR_READ,
+						&phys_addr);
+				if (run == 0) {
 					// Error
 					break;
 				}
 
-				phys_addr = m_atc.virt_to_phys(virt_addr);
+				phys_read(phys_addr, buf + buf_len, run);
 
-				//
-				// Adjust length to not cross SZ_4K boundaries
-				//
-				md5_len = (len <= SZ_4K) ? len : SZ_4K;
-				md5_len -= (phys_addr & mask);
+				buf_len += run;
+				virt_addr += run;
+				len -= run;
+			}
+
+			if (buf_len == 0) {
+				break;
+			}
+
+			//
+			// Hand over the buffer for hashing
+			//
+			ctx.hash_pipe.submit(buf_len);
+		}
+
+		ctx.hash_pipe.drain();
 
-				phys_read(phys_addr, data, md5_len);
+		if (len != 0) {
+			return false;
+		}
+
+		memset(digest, 0, digest_engine::MAX_DIGEST_LENGTH);
+		engine->final(digest);
+		*digest_length = engine->digest_length();
+
+		return true;
+	}
+
+	//
+	// Copy len bytes between two virtual address ranges, through the
+	// context's bounce buffer.
+	//
+	// ctx: the job context to use
+	// dst_addr: the start address of the destination range
+	// src_addr: the start address of the source range
+	// len: the amount of data to copy
+	//
+	// returns: true on success, false on a translation error
+	//
+	bool do_copy(JobContext &ctx, uint64_t dst_addr, uint64_t src_addr,
+			uint64_t len)
+	{
+		while (len) {
+			uint64_t chunk = len;
+
+			if (chunk > ctx.buf.size()) {
+				chunk = ctx.buf.size();
+			}
+
+			if (!dma_virt(ctx.prefetcher, tlm::TLM_READ_COMMAND,
+					src_addr, ctx.buf.data(), chunk) ||
+				!dma_virt(ctx.prefetcher, tlm::TLM_WRITE_COMMAND,
+					dst_addr, ctx.buf.data(), chunk)) {
+				return false;
+			}
+
+			dst_addr += chunk;
+			src_addr += chunk;
+			len -= chunk;
+		}
+		return true;
+	}
+
+	//
+	// Fill a virtual address range with a repeated 32 bit pattern (the
+	// pattern restarts at dst_addr).
+	//
+	// ctx: the job context to use
+	// dst_addr: the start address of the range
+	// pattern: the pattern
+	// len: the length of the range
+	//
+	// returns: true on success, false on a translation error
+	//
+	bool do_fill(JobContext &ctx, uint64_t dst_addr, uint32_t pattern,
+			uint64_t len)
+	{
+		unsigned int i;
+
+		for (i = 0; i < ctx.buf.size(); i += sizeof(pattern)) {
+			memcpy(&ctx.buf[i], &pattern, sizeof(pattern));
+		}
+
+		while (len) {
+			uint64_t chunk = len;
+
+			if (chunk > ctx.buf.size()) {
+				chunk = ctx.buf.size();
+			}
+
+			if (!dma_virt(ctx.prefetcher, tlm::TLM_WRITE_COMMAND,
+					dst_addr, ctx.buf.data(), chunk)) {
+				return false;
+			}
+
+			dst_addr += chunk;
+			len -= chunk;
+		}
+		return true;
+	}
+
+	//
+	// This thread waits for an 'm_bulk_event' which is notified when
+	// the R_CTRL register is written with the value R_CTRL_COPY or
+	// R_CTRL_FILL. After receiving the event the thread copies R_LENGTH
+	// bytes from the virtual address in R_ADDR_MSB and R_ADDR_LSB to the
+	// virtual address in R_DST_ADDR_MSB and R_DST_ADDR_LSB, or fills
+	// R_LENGTH bytes at the destination address with the 32 bit pattern
+	// in R_VAL. Both sides are translated through the ATC and the data
+	// is moved with one DMA per physically contiguous run.
+	//
+	// After the operation has completed R_STATUS_DONE is set in the
+	// R_STATUS register. In case of an error R_STATUS_ERR is notified.
+	//
+	void bulk_thread()
+	{
+		while (true) {
+			uint64_t src_addr;
+			uint64_t dst_addr;
+			bool ok;
 
-				MD5_Update(&ctx, reinterpret_cast<void*>(data), md5_len);
+			wait(m_bulk_event);
 
-				virt_addr += md5_len;
-				len -= md5_len;
+			src_addr = static_cast<uint64_t>(regs.addr_msb) << 32 |
+					regs.addr_lsb;
+			dst_addr = static_cast<uint64_t>(regs.dst_addr_msb) << 32 |
+					regs.dst_addr_lsb;
+
+			if (regs.ctrl & R_CTRL_COPY) {
+				ok = do_copy(m_bulk_ctx, dst_addr, src_addr,
+						regs.length);
+			} else {
+				ok = do_fill(m_bulk_ctx, dst_addr, regs.value,
+						regs.length);
 			}
 
-			if (len != 0) {
-				regs.status = R_STATUS_ERR | R_STATUS_DONE;
+			done(ok ? R_STATUS_DONE : R_STATUS_ERR | R_STATUS_DONE);
+		}
+	}
+
+	//
+	// This thread waits for an 'm_digest_event' which is notified when
+	// the R_CTRL register is written with the value R_CTRL_DIGEST
+	// (R_CTRL_MD5SUM). After receiving the event the thread will compute
+	// the message digest, using the algorithm selected in the R_CTRL
+	// algorithm field (MD5 by default), of the virtual address area
+	// starting from the address configured in the address registers
+	// R_ADDR_MSB and R_ADDR_LSB and with length configured in the
+	// R_LENGTH register. The result is placed to be read out in the
+	// R_DIGEST_X registers (the first four words are also found in the
+	// R_MD5_RESULT_X registers) and the length of the digest in the
+	// R_DIGEST_LENGTH register.
+	//
+	// After the digest computation has completed R_STATUS_DONE is set in
+	// the R_STATUS register. In case of an error R_STATUS_ERR is notified.
+	//
+	void digest_thread()
+	{
+		while (true) {
+			uint8_t res[digest_engine::MAX_DIGEST_LENGTH];
+			unsigned int algo;
+			unsigned int i;
+			uint64_t virt_addr;
+
+			wait(m_digest_event);
+
+			virt_addr = static_cast<uint64_t>(regs.addr_msb) << 32 |
+					regs.addr_lsb;
+			algo = (regs.ctrl & R_CTRL_ALGO_MASK) >> R_CTRL_ALGO_SHIFT;
+
+			if (!do_digest(m_reg_ctx, algo, virt_addr, regs.length,
+					res, &regs.digest_length)) {
+				done(R_STATUS_ERR | R_STATUS_DONE);
 				continue;
 			}
 
-			MD5_Final(res, &ctx);
+			for (i = 0; i < digest_engine::MAX_DIGEST_LENGTH / 4; i++) {
+				regs.digest[i] = (res[i * 4 + 0] << 0) |
+						(res[i * 4 + 1] << 8) |
+						(res[i * 4 + 2] << 16) |
+						(res[i * 4 + 3] << 24);
+			}
+
+			done(R_STATUS_DONE);
+		}
+	}
+
+	//
+	// Run a job from the submission queue.
+	//
+	// ctx: the job context to use
+	// desc: the job descriptor
+	// comp: the completion to fill in
+	//
+	// returns: the completion status (R_STATUS_X bits)
+	//
+	uint32_t run_job(JobContext &ctx, JobDescriptor &desc,
+			JobCompletion *comp)
+	{
+		unsigned int algo;
+		bool ok;
+
+		switch (desc.ctrl & JOB_OP_MASK) {
+		case JOB_OP_DIGEST:
+			algo = (desc.ctrl & R_CTRL_ALGO_MASK) >>
+					R_CTRL_ALGO_SHIFT;
+			ok = do_digest(ctx, algo, desc.src_addr, desc.length,
+					comp->digest, &comp->digest_length);
+			break;
+		case JOB_OP_COPY:
+			ok = do_copy(ctx, desc.dst_addr, desc.src_addr,
+					desc.length);
+			break;
+		case JOB_OP_FILL:
+			ok = do_fill(ctx, desc.dst_addr, desc.src_addr,
+					desc.length);
+			break;
+		default:
+			ok = false;
+			break;
+		}
+
+		return ok ? R_STATUS_DONE : R_STATUS_ERR | R_STATUS_DONE;
+	}
 
-			regs.md5_result0 = (res[0] << 0) | (res[1] << 8) |
-						(res[2] << 16) | (res[3] << 24);
-			regs.md5_result1 = (res[4] << 0) | (res[5] << 8) |
-						(res[6] << 16) | (res[7] << 24);
-			regs.md5_result2 = (res[8] << 0) | (res[9] << 8) |
-						(res[10] << 16) | (res[11] << 24);
-			regs.md5_result3 = (res[12] << 0) | (res[13] << 8) |
-						(res[14] << 16) | (res[15] << 24);
+	//
+	// Write a completion into the next completion queue entry, waits
+	// for the host to free an entry (advance R_CQ_HEAD) if the queue is
+	// full. The completion is dropped if the queues were reset or
+	// disabled (R_QUEUE_SIZE written) since the job was claimed.
+	//
+	// ctx: the job context of the calling worker
+	// comp: the completion to post
+	// gen: m_queue_gen when the job was claimed
+	//
+	void post_completion(JobContext &ctx, JobCompletion &comp,
+				uint32_t gen)
+	{
+		uint64_t cq_base;
+		uint32_t idx;
 
-			regs.status = R_STATUS_DONE;
+		while (gen == m_queue_gen &&
+			m_cq_tail - regs.cq_head >= regs.queue_size) {
+			wait(m_cq_doorbell_event);
+		}
+
+		if (gen != m_queue_gen || regs.queue_size == 0) {
+			return;
+		}
+
+		cq_base = static_cast<uint64_t>(regs.cq_base_msb) << 32 |
+				regs.cq_base_lsb;
+
+		idx = m_cq_tail++ & (regs.queue_size - 1);
+
+		//
+		// The entry, including the status, is written with a single
+		// DMA write
+		//
+		if (!dma_virt(ctx.prefetcher, tlm::TLM_WRITE_COMMAND,
+				cq_base + idx * sizeof(comp),
+				reinterpret_cast<uint8_t*>(&comp), sizeof(comp))) {
+			regs.status = R_STATUS_ERR | R_STATUS_DONE;
+		}
+
+		raise_irq(IRQ_QUEUE);
+	}
+
+	//
+	// Job queue workers, 'nr_workers' of these threads are spawned. A
+	// worker waits for the submission queue doorbell (R_SQ_TAIL),
+	// claims the next submission queue entry, fetches the descriptor from
+	// host memory and runs the job, the workers process jobs
+	// concurrently. When the job is done the worker posts a completion
+	// (with the descriptor's tag) into the completion queue, completions
+	// are posted in the order the jobs finish. Jobs claimed before the
+	// queues were reset complete without a completion.
+	//
+	// id: the worker number
+	//
+	void queue_worker_thread(unsigned int id)
+	{
+		JobContext *ctx = m_workers[id];
+
+		while (true) {
+			JobDescriptor desc;
+			JobCompletion comp;
+			uint64_t sq_base;
+			uint32_t head;
+			uint32_t idx;
+			uint32_t gen;
+
+			while (regs.queue_size == 0 ||
+				regs.sq_head == regs.sq_tail) {
+				wait(m_sq_doorbell_event);
+			}
+
+			sq_base = static_cast<uint64_t>(regs.sq_base_msb) << 32 |
+					regs.sq_base_lsb;
+
+			//
+			// Claim the entry
+			//
+			gen = m_queue_gen;
+			head = regs.sq_head++;
+			idx = head & (regs.queue_size - 1);
+
+			memset(&comp, 0, sizeof(comp));
+
+			if (!dma_virt(ctx->prefetcher, tlm::TLM_READ_COMMAND,
+					sq_base + idx * sizeof(desc),
+					reinterpret_cast<uint8_t*>(&desc),
+					sizeof(desc))) {
+				comp.tag = head;
+				comp.status = R_STATUS_ERR | R_STATUS_DONE;
+			} else {
+				comp.tag = desc.tag;
+				comp.status = run_job(*ctx, desc, &comp);
+			}
+
+			post_completion(*ctx, comp, gen);
 		}
 	}
 
@@ -693,13 +2034,46 @@ err:
 	sc_event m_ats_req_event;
 	sc_event m_read_event;
 	sc_event m_write_event;
-	sc_event m_md5_event;
+	sc_event m_digest_event;
+	sc_event m_bulk_event;
+	sc_event m_sq_doorbell_event;
+	sc_event m_cq_doorbell_event;
+	sc_event m_irq_event[NR_IRQ];
+	bool m_irq_pending[NR_IRQ];
+
+	//
+	// Pages translated ahead of the consumers (R_ATC_PREFETCH) and the
+	// prefetcher of the register interface's translate, read and write
+	// operations (the job contexts have their own)
+	//
+	unsigned int m_prefetch_pages;
+	Prefetcher m_reg_prefetcher;
+
+	//
+	// Payloads for the DMA and ATS requests
+	//
+	PayloadPool m_pool;
 
 	//
 	// Address translation cache
 	//
 	ATC m_atc;
 
+	//
+	// Job contexts used by the register interface (digests and
+	// copies / fills) and the ones of the job queue workers
+	//
+	JobContext m_reg_ctx;
+	JobContext m_bulk_ctx;
+	std::vector<JobContext *> m_workers;
+
+	//
+	// Next completion queue entry to write and the number of queue
+	// resets (R_QUEUE_SIZE writes)
+	//
+	uint32_t m_cq_tail;
+	uint32_t m_queue_gen;
+
 	//
 	// Registers
 	//
@@ -712,26 +2086,61 @@ err:
 			uint32_t status;
 			uint32_t addr_msb;
 
-			uint32_t md5_result0;
-			uint32_t md5_result1;
-			uint32_t md5_result2;
-			uint32_t md5_result3;
+			uint32_t digest[digest_engine::MAX_DIGEST_LENGTH / 4];
+			uint32_t digest_length;
+
+			uint32_t sq_base_lsb;
+			uint32_t sq_base_msb;
+			uint32_t cq_base_lsb;
+			uint32_t cq_base_msb;
+			uint32_t queue_size;
+			uint32_t sq_tail;
+			uint32_t sq_head;
+			uint32_t cq_head;
+
+			uint32_t irq_enable;
+
+			uint32_t dst_addr_lsb;
+			uint32_t dst_addr_msb;
 		};
-		uint32_t u32[10];
+		uint32_t u32[6 + digest_engine::MAX_DIGEST_LENGTH / 4 + 1 + 8 + 1 + 2];
 	} regs;
 public:
 	SC_HAS_PROCESS(pcie_acc);
 	sc_in<bool> rst;
 
-	pcie_acc(sc_core::sc_module_name name) :
+	//
+	// atc_nr_entries: total number of ATC entries
+	// atc_nr_ways: associativity of the ATC (atc_nr_entries for a
+	//              fully associative ATC)
+	// atc_lru: use LRU replacement in the ATC (else CLOCK)
+	// prefetch_pages: number of pages to translate ahead of the
+	//                 consumer (0 disables the prefetcher)
+	// nr_workers: number of threads processing the job queue
+	//
+	pcie_acc(sc_core::sc_module_name name,
+			unsigned int atc_nr_entries = ATC_NR_ENTRIES,
+			unsigned int atc_nr_ways = ATC_NR_WAYS,
+			bool atc_lru = true,
+			unsigned int prefetch_pages = ATC_PREFETCH_PAGES,
+			unsigned int nr_workers = NR_QUEUE_WORKERS) :
 		pci_device_base(name, NR_MMIO_BAR, NR_IRQ),
 		m_ats_req_event("ats-req-event"),
 		m_read_event("read-event"),
 		m_write_event("write-event"),
-		m_md5_event("md5-event"),
-		m_atc(ats_req),
+		m_digest_event("digest-event"),
+		m_bulk_event("bulk-event"),
+		m_sq_doorbell_event("sq-doorbell-event"),
+		m_cq_doorbell_event("cq-doorbell-event"),
+		m_prefetch_pages(prefetch_pages),
+		m_atc(ats_req, m_pool, atc_nr_entries, atc_nr_ways,
+			atc_lru ? ATC::POLICY_LRU : ATC::POLICY_CLOCK),
+		m_cq_tail(0),
+		m_queue_gen(0),
 		rst("rst")
 	{
+		unsigned int i;
+
 		memset(&regs, 0, sizeof regs);
 
 		SC_METHOD(reset);
@@ -741,7 +2150,32 @@ public:
 		SC_THREAD(ats_req_thread);
 		SC_THREAD(read_thread);
 		SC_THREAD(write_thread);
-		SC_THREAD(md5_thread);
+		SC_THREAD(digest_thread);
+		SC_THREAD(bulk_thread);
+		spawn_prefetcher(m_reg_prefetcher);
+		spawn_prefetcher(m_reg_ctx.prefetcher);
+		spawn_prefetcher(m_bulk_ctx.prefetcher);
+
+		for (i = 0; i < NR_IRQ; i++) {
+			m_irq_pending[i] = false;
+			sc_spawn(sc_bind(&pcie_acc::irq_thread, this, i));
+		}
+
+		for (i = 0; i < nr_workers; i++) {
+			m_workers.push_back(new JobContext());
+			spawn_prefetcher(m_workers[i]->prefetcher);
+			sc_spawn(sc_bind(&pcie_acc::queue_worker_thread,
+						this, i));
+		}
+	}
+
+	~pcie_acc()
+	{
+		unsigned int i;
+
+		for (i = 0; i < m_workers.size(); i++) {
+			delete m_workers[i];
+		}
 	}
 };
 
@@ -27,6 +27,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 
@@ -60,10 +61,13 @@ public:
 	pcie_acc acc;
 	sc_signal<bool> rst;
 
-	Top(sc_module_name name, const char *sk_descr, sc_time quantum) :
+	Top(sc_module_name name, const char *sk_descr, sc_time quantum,
+		unsigned int atc_nr_entries, unsigned int atc_nr_ways,
+		bool atc_lru, unsigned int nr_workers) :
 		sc_module(name),
 		rp_pci_ep("rp-pci-ep", 0, NR_MMIO_BAR, NR_IRQ, sk_descr),
-		acc("pci-acc"),
+		acc("pci-acc", atc_nr_entries, atc_nr_ways, atc_lru,
+			ATC_PREFETCH_PAGES, nr_workers),
 		rst("rst")
 	{
 		m_qk.set_global_quantum(quantum);
@@ -89,13 +93,18 @@ private:
 
 void usage(void)
 {
-	cout << "tlm socket-path sync-quantum-ns" << endl;
+	cout << "tlm socket-path sync-quantum-ns "
+		"[atc-entries [atc-ways [lru|clock [queue-workers]]]]" << endl;
 }
 
 int sc_main(int argc, char* argv[])
 {
 	Top *top;
 	uint64_t sync_quantum;
+	unsigned int atc_nr_entries = ATC_NR_ENTRIES;
+	unsigned int atc_nr_ways = ATC_NR_WAYS;
+	bool atc_lru = true;
+	unsigned int nr_workers = NR_QUEUE_WORKERS;
 	sc_trace_file *trace_fp = NULL;
 
 #if HAVE_VERILOG_VERILATOR
@@ -108,9 +117,32 @@ int sc_main(int argc, char* argv[])
 		sync_quantum = strtoull(argv[2], NULL, 10);
 	}
 
+	if (argc > 3) {
+		atc_nr_entries = strtoul(argv[3], NULL, 10);
+		// Fully associative unless the ways are specified
+		atc_nr_ways = atc_nr_entries;
+	}
+	if (argc > 4) {
+		atc_nr_ways = strtoul(argv[4], NULL, 10);
+	}
+	if (argc > 5) {
+		atc_lru = strcmp(argv[5], "clock") != 0;
+	}
+	if (argc > 6) {
+		nr_workers = strtoul(argv[6], NULL, 10);
+	}
+
+	if (atc_nr_ways == 0 || atc_nr_entries < atc_nr_ways ||
+		atc_nr_entries % atc_nr_ways) {
+		cout << "atc-entries must be a non-zero multiple of atc-ways"
+			<< endl;
+		exit(EXIT_FAILURE);
+	}
+
 	sc_set_time_resolution(1, SC_PS);
 
-	top = new Top("top", argv[1], sc_time((double) sync_quantum, SC_NS));
+	top = new Top("top", argv[1], sc_time((double) sync_quantum, SC_NS),
+			atc_nr_entries, atc_nr_ways, atc_lru, nr_workers);
 
 	if (argc < 3) {
 		sc_start(1, SC_PS);
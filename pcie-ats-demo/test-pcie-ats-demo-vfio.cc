@@ -23,6 +23,8 @@
 
 #include <sstream>
 #include <iomanip>
+#include <chrono>
+#include <getopt.h>
 
 #define SC_INCLUDE_DYNAMIC_PROCESSES
 
@@ -36,16 +38,24 @@ using namespace std;
 #include "tlm_utils/simple_target_socket.h"
 
 #include "tlm-modules/tlm-splitter.h"
-#include "tlm-bridges/tlm2vfio-bridge.h"
+#include "pcie-acc-backend.h"
 
 #define SZ_4K (4 * 1024)
 #define SZ_32K (32 * 1024)
+#define SZ_64K (64 * 1024)
+#define SZ_1M (1024 * 1024)
+#define SZ_2M (2 * 1024 * 1024)
+#define SZ_16M (16 * 1024 * 1024)
+
+//
+// IOVA range the buffers are placed in
+//
+#define IOVA_BASE 0
+#define IOVA_SIZE (1ULL << 40)
 
 // Top simulation module.
 SC_MODULE(Top)
 {
-	vfio_dev vdev;
-
 	SC_HAS_PROCESS(Top);
 
 	enum {
@@ -59,40 +69,104 @@ SC_MODULE(Top)
 		R_MD5_RESULT_1 = 0x1C,
 		R_MD5_RESULT_2 = 0x20,
 		R_MD5_RESULT_3 = 0x24,
+		R_ATC_HITS_LSB = 0x28,
+		R_ATC_HITS_MSB = 0x2C,
+		R_ATC_MISSES_LSB = 0x30,
+		R_ATC_MISSES_MSB = 0x34,
+		R_ATC_GEOMETRY = 0x48,
+		R_SQ_BASE_LSB = 0x54,
+		R_SQ_BASE_MSB = 0x58,
+		R_CQ_BASE_LSB = 0x5C,
+		R_CQ_BASE_MSB = 0x60,
+		R_QUEUE_SIZE = 0x64,
+		R_SQ_TAIL = 0x68,
+		R_SQ_HEAD = 0x6C,
+		R_CQ_HEAD = 0x70,
+		R_QUEUE_WORKERS = 0x74,
+		R_IRQ_ENABLE = 0x78,
+		R_DST_ADDR_LSB = 0xA0,
+		R_DST_ADDR_MSB = 0xA4,
+		R_ATS_REQUESTS_LSB = 0xA8,
+		R_ATS_REQUESTS_MSB = 0xAC,
 
 		R_CTRL_TRANSLATE = 1 << 0,
 		R_CTRL_READ = 1 << 1,
 		R_CTRL_WRITE = 1 << 2,
 		R_CTRL_MD5SUM = 1 << 3,
+		R_CTRL_ATC_STATS_CLEAR = 1 << 4,
+		R_CTRL_COPY = 1 << 5,
+		R_CTRL_FILL = 1 << 6,
 
 		R_STATUS_DONE = 1 << 0,
 		R_STATUS_ERR = 1 << 1,
+
+		IRQ_DONE = 0,
+		IRQ_QUEUE = 1,
+
+		JOB_OP_DIGEST = 1,
+		JOB_OP_COPY = 2,
+	};
+
+	//
+	// Job queue entries (see pcie-acc.h)
+	//
+	struct JobDescriptor {
+		uint32_t ctrl;
+		uint32_t length;
+		uint64_t src_addr;
+		uint64_t dst_addr;
+		uint64_t tag;
+	};
+
+	struct JobCompletion {
+		uint64_t tag;
+		uint32_t status;
+		uint32_t digest_length;
+		uint8_t digest[32];
+		uint8_t reserved[16];
 	};
 
-	Top(sc_module_name name, const char *devname, int iommu_group,
-			const char *filename) :
+	//
+	// be: the accelerator
+	// loopback: the in-process accelerator if that is what 'be' is,
+	//           else NULL
+	// filename: the input of the MD5 test
+	// bench_iters: run the benchmark with this many operations per
+	//              measurement instead of the tests, 0 runs the tests
+	//
+	Top(sc_module_name name, pcie_acc_backend &be,
+			pcie_acc_loopback *loopback, const char *filename,
+			unsigned int bench_iters) :
 		sc_module(name),
-		vdev(devname, iommu_group),
+		m_be(be),
+		m_loopback(loopback),
+		m_mapper(be, IOVA_BASE, IOVA_SIZE),
 		m_map(0),
 		m_map_size(SZ_32K),
-		m_filename(filename)
+		m_iova(0),
+		m_filename(filename),
+		m_bench_iters(bench_iters),
+		nr_failed(0)
 	{
 		map_mem();
 
-		SC_THREAD(run_tests);
+		if (m_bench_iters) {
+			SC_THREAD(run_bench);
+		} else {
+			SC_THREAD(run_tests);
+		}
 	}
 
 	~Top()
 	{
-		vdev.iommu_unmap_dma((uintptr_t) 0, m_map_size,
-			VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE);
+		m_mapper.unmap(m_map, m_map_size);
+		m_mapper.flush();
 		munmap(m_map, m_map_size);
 	}
 
 	void map_mem()
 	{
 		int flags = MAP_SHARED | MAP_ANONYMOUS;
-		uintptr_t map_uint;
 		void *m;
 
 		m = mmap(0, m_map_size, PROT_READ | PROT_WRITE, flags, 0, 0);
@@ -105,33 +179,60 @@ SC_MODULE(Top)
 		mlock(m, m_map_size * 2);
 
 		m_map = (uint8_t *) m;
-		map_uint = (uintptr_t) m_map;
 
-		vdev.iommu_map_dma(map_uint, 0, m_map_size,
-			VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE);
+		if (!m_mapper.map(m_map, m_map_size, true, &m_iova)) {
+			SC_REPORT_ERROR("tlm_mm_vfio", "out of IOVA space");
+		}
 	}
 
-	void wait_for_done()
+	//
+	// Program a 64 bit address register pair.
+	//
+	void write_addr(uint32_t lsb, uint32_t msb, uint64_t addr)
+	{
+		write32(msb, addr >> 32);
+		write32(lsb, addr);
+	}
+
+	//
+	// Sleep until the vector has fired (returns immediately when polling).
+	//
+	void wait_irq(unsigned int vec)
+	{
+		if (m_be.has_irqs()) {
+			m_be.wait_irq(vec);
+		}
+	}
+
+	uint32_t wait_for_done()
 	{
 		uint32_t r;
 
+		if (!m_be.has_irqs()) {
+			do {
+				r = read32(R_STATUS);
+			} while (r == 0);
+			return r;
+		}
+
 		do {
+			wait_irq(IRQ_DONE);
 			r = read32(R_STATUS);
 		} while (r == 0);
+		return r;
 	}
 
 	void test_ATC_load()
 	{
 		cout << " * " << __func__
-			<< ", translate addr: 0x0"
+			<< ", translate addr: 0x" << hex << m_iova
 			<< ", length: 32 K" << endl;
 
-		write32(R_ADDR_MSB, 0);
-		write32(R_ADDR_LSB, 0);
+		write_addr(R_ADDR_LSB, R_ADDR_MSB, m_iova);
 		write32(R_LENGTH, SZ_32K);
 		write32(R_STATUS, 0);
 		write32(R_CTRL, R_CTRL_TRANSLATE);
-		wait_for_done();
+		check(!(wait_for_done() & R_STATUS_ERR));
 	}
 
 	void test_read()
@@ -147,13 +248,12 @@ SC_MODULE(Top)
 			m_map[addr + 2] = 0xCC;
 			m_map[addr + 3] = 0xDD;
 
-			write32(R_ADDR_MSB, 0);
-			write32(R_ADDR_LSB, addr);
+			write_addr(R_ADDR_LSB, R_ADDR_MSB, m_iova + addr);
 			write32(R_LENGTH, 4);
 
 			write32(R_STATUS, 0);
 			write32(R_CTRL, R_CTRL_READ);
-			wait_for_done();
+			check(!(wait_for_done() & R_STATUS_ERR));
 
 			cout << "   - Read data: 0x" << hex
 				<< read32(R_VAL) << endl;
@@ -169,14 +269,13 @@ SC_MODULE(Top)
 				<< hex << addr << " with data: 0x"
 				<< addr << endl;;
 
-			write32(R_ADDR_MSB, 0);
-			write32(R_ADDR_LSB, addr);
+			write_addr(R_ADDR_LSB, R_ADDR_MSB, m_iova + addr);
 			write32(R_LENGTH, 4);
 
 			write32(R_STATUS, 0);
 			write32(R_VAL, addr);
 			write32(R_CTRL, R_CTRL_WRITE);
-			wait_for_done();
+			check(!(wait_for_done() & R_STATUS_ERR));
 
 			cout << "   - data at addr: 0x" << hex << addr << ", data: 0x"
 				<< reinterpret_cast<uint32_t*>(&m_map[addr])[0]
@@ -184,14 +283,147 @@ SC_MODULE(Top)
 		}
 	}
 
+	//
+	// Copy the first 8 KiB of the scratch area to 0x6000 and fill it
+	// back with a pattern using the bulk DMA commands.
+	//
+	void test_copy_fill()
+	{
+		const uint32_t dst_addr = 0x6000;
+		const uint32_t len = SZ_4K * 2;
+		const uint32_t pattern = 0xA5C3E187;
+		uint32_t i;
+		bool ok;
+
+		cout << " * " << __func__ << ", copy 0x0 -> 0x" << hex
+			<< dst_addr << ", length: 8 K" << endl;
+
+		memset(&m_map[dst_addr], 0, len);
+
+		write_addr(R_ADDR_LSB, R_ADDR_MSB, m_iova);
+		write_addr(R_DST_ADDR_LSB, R_DST_ADDR_MSB, m_iova + dst_addr);
+		write32(R_LENGTH, len);
+		write32(R_STATUS, 0);
+		write32(R_CTRL, R_CTRL_COPY);
+		check(!(wait_for_done() & R_STATUS_ERR));
+
+		ok = !memcmp(&m_map[0], &m_map[dst_addr], len);
+		check(ok);
+		cout << "   - copied data " << (ok ? "matches" : "differs")
+			<< endl;
+
+		cout << " * " << __func__ << ", fill 0x" << hex << dst_addr
+			<< " with 0x" << pattern << ", length: 8 K" << endl;
+
+		write32(R_VAL, pattern);
+		write32(R_STATUS, 0);
+		write32(R_CTRL, R_CTRL_FILL);
+		check(!(wait_for_done() & R_STATUS_ERR));
+
+		ok = true;
+		for (i = 0; i < len; i += sizeof(pattern)) {
+			uint32_t v;
+
+			memcpy(&v, &m_map[dst_addr + i], sizeof(v));
+			if (v != pattern) {
+				ok = false;
+			}
+		}
+		check(ok);
+		cout << "   - filled data " << (ok ? "matches" : "differs")
+			<< endl;
+	}
+
+	//
+	// Submit copy jobs and a MD5 job through the job queues. The queues
+	// and the copy destination are placed in the second half of the
+	// scratch area:
+	//
+	// 0x0000 - 0x1FFF: copy source / MD5 input
+	// 0x4000: submission queue
+	// 0x5000: completion queue
+	// 0x6000 - 0x7FFF: copy destination
+	//
+	void test_queue()
+	{
+		const unsigned int queue_size = 16;
+		const unsigned int nr_copies = 8;
+		const uint32_t sq_addr = 0x4000;
+		const uint32_t cq_addr = 0x5000;
+		const uint32_t dst_addr = 0x6000;
+		const uint32_t copy_len = SZ_4K * 2 / nr_copies;
+		JobDescriptor *sq = reinterpret_cast<JobDescriptor*>(
+						&m_map[sq_addr]);
+		volatile JobCompletion *cq =
+			reinterpret_cast<volatile JobCompletion*>(
+						&m_map[cq_addr]);
+		unsigned int i;
+		bool ok;
+
+		cout << " * " << __func__ << ", " << dec
+			<< read32(R_QUEUE_WORKERS) << " workers" << endl;
+
+		memset(&m_map[sq_addr], 0, SZ_4K * 2);
+		memset(&m_map[dst_addr], 0, SZ_4K * 2);
+
+		write_addr(R_SQ_BASE_LSB, R_SQ_BASE_MSB, m_iova + sq_addr);
+		write_addr(R_CQ_BASE_LSB, R_CQ_BASE_MSB, m_iova + cq_addr);
+		write32(R_QUEUE_SIZE, queue_size);
+
+		for (i = 0; i < nr_copies; i++) {
+			sq[i].ctrl = JOB_OP_COPY;
+			sq[i].length = copy_len;
+			sq[i].src_addr = m_iova + i * copy_len;
+			sq[i].dst_addr = m_iova + dst_addr + i * copy_len;
+			sq[i].tag = i;
+		}
+		sq[i].ctrl = JOB_OP_DIGEST;
+		sq[i].length = SZ_4K * 2;
+		sq[i].src_addr = m_iova;
+		sq[i].tag = i;
+
+		//
+		// Ring the doorbell once for all jobs
+		//
+		write32(R_SQ_TAIL, nr_copies + 1);
+
+		for (i = 0; i < nr_copies + 1; i++) {
+			while (!(cq[i].status & R_STATUS_DONE)) {
+				wait_irq(IRQ_QUEUE);
+			}
+
+			check(!(cq[i].status & R_STATUS_ERR));
+			cout << "   - job " << dec << cq[i].tag
+				<< (cq[i].status & R_STATUS_ERR ?
+					": error" : ": done");
+
+			if (cq[i].tag == nr_copies) {
+				unsigned int j;
+
+				cout << ", MD5 result: ";
+				for (j = 0; j < cq[i].digest_length; j++) {
+					cout << hex << right
+						<< setw(2) << setfill('0')
+						<< (unsigned int) cq[i].digest[j];
+				}
+			}
+			cout << endl;
+		}
+		write32(R_CQ_HEAD, i);
+
+		ok = !memcmp(&m_map[0], &m_map[dst_addr], SZ_4K * 2);
+		check(ok);
+		cout << "   - copied data " << (ok ? "matches" : "differs")
+			<< endl;
+	}
+
 	//
 	// Compute the MD5 message digest on input file
 	//
 	void test_md5()
 	{
-		uintptr_t map_uint;
 		uint64_t map_size;
-		uint8_t *tmp;
+		uint64_t iova;
 		struct stat s;
 		void *mbuf;
 		int fd;
@@ -226,19 +458,18 @@ SC_MODULE(Top)
 		mlock(mbuf, map_size);
 
 		// vfio map.
-		tmp = (uint8_t *) mbuf;
-		map_uint = (uintptr_t) tmp;
-		vdev.iommu_map_dma(map_uint, SZ_32K, map_size,
-			VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE);
+		if (!m_mapper.map(mbuf, map_size, false, &iova)) {
+			cout << "out of IOVA space" << endl;
+			goto err1;
+		}
 
 		// MD5
-		write32(R_ADDR_MSB, 0);
-		write32(R_ADDR_LSB, SZ_32K);
+		write_addr(R_ADDR_LSB, R_ADDR_MSB, iova);
 		write32(R_LENGTH, s.st_size);
 
 		write32(R_STATUS, 0);
 		write32(R_CTRL, R_CTRL_MD5SUM);
-		wait_for_done();
+		check(!(wait_for_done() & R_STATUS_ERR));
 
 		cout << "   - MD5 result: ";
 		for (uint32_t addr = R_MD5_RESULT_0;
@@ -254,70 +485,443 @@ SC_MODULE(Top)
 		}
 		cout << endl;
 
-		vdev.iommu_unmap_dma((uintptr_t) SZ_32K, map_size,
-			VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE);
+		//
+		// Drop the cached mapping too, the buffer is about to go away
+		//
+		m_mapper.unmap(mbuf, map_size);
+		m_mapper.flush();
 
 		if (munmap(mbuf, s.st_size) ) {
 			perror("munmap");
 		}
 
 		close(fd);
-
-		sc_stop();
-
 		return;
 err1:
 		close(fd);
 		exit(EXIT_FAILURE);
 	}
 
+	//
+	// Exercise the DMA mapping manager against a mock backend.
+	//
+	void test_dma_mapper()
+	{
+		static uint8_t buf[SZ_32K * 2];
+		dma_map_mock mock;
+		bool ok = true;
+		uint64_t iova[4];
+
+		cout << " * " << __func__ << endl;
+
+		{
+			vfio_dma_mapper mapper(mock, SZ_4K, IOVA_SIZE, SZ_32K);
+
+			// A mapping is reused for the same buffer and parts of it
+			ok &= mapper.map(buf, SZ_32K, true, &iova[0]);
+			ok &= mapper.map(buf, SZ_32K, false, &iova[1]);
+			ok &= mapper.map(buf + SZ_4K, SZ_4K, true, &iova[2]);
+			ok &= iova[0] == iova[1] && iova[2] == iova[0] + SZ_4K;
+			ok &= mock.nr_maps == 1 && mapper.nr_hits == 2;
+			mapper.unmap(buf + SZ_4K, SZ_4K);
+			mapper.unmap(buf, SZ_32K);
+			mapper.unmap(buf, SZ_32K);
+
+			// Unreferenced mappings stay cached
+			ok &= mock.maps.size() == 1;
+			ok &= mapper.map(buf, SZ_32K, false, &iova[1]);
+			ok &= iova[1] == iova[0] && mock.nr_maps == 1;
+
+			// New mappings honor the alignment
+			ok &= mapper.map(buf + SZ_32K, SZ_32K, false, &iova[3],
+						SZ_32K * 2);
+			ok &= !(iova[3] & (SZ_32K * 2 - 1));
+			mapper.unmap(buf, SZ_32K);
+
+			// The cache size limit evicts the oldest mapping
+			mapper.unmap(buf + SZ_32K, SZ_32K);
+			ok &= mock.maps.size() == 1 && mapper.nr_evictions == 1;
+			ok &= mock.maps.count(iova[3]) == 1;
+
+			mapper.flush();
+			ok &= mock.maps.empty();
+
+			// A write mapping upgrades a read-only one in place
+			ok &= mapper.map(buf, SZ_32K, false, &iova[0]);
+			ok &= mapper.map(buf, SZ_32K, true, &iova[1]);
+			ok &= iova[1] == iova[0] && mock.maps.size() == 1;
+			ok &= mock.maps[iova[0]].write;
+			mapper.unmap(buf, SZ_32K);
+			mapper.unmap(buf, SZ_32K);
+			mapper.flush();
+			ok &= mock.maps.empty();
+
+			// So does a write mapping of a part of it
+			ok &= mapper.map(buf, SZ_32K, false, &iova[0]);
+			ok &= mapper.map(buf + SZ_4K, SZ_4K, true, &iova[2]);
+			ok &= iova[2] == iova[0] + SZ_4K && mock.maps.size() == 1;
+			ok &= mock.maps[iova[0]].write;
+			mapper.unmap(buf + SZ_4K, SZ_4K);
+			mapper.unmap(buf, SZ_32K);
+			mapper.flush();
+			ok &= mock.maps.empty();
+
+			ok &= mapper.map(buf, SZ_32K, true, &iova[0]);
+		}
+		// The mapper unmaps everything when it goes away
+		ok &= mock.maps.empty() && mock.nr_maps == mock.nr_unmaps;
+
+		check(ok);
+		cout << "   - " << (ok ? "passed" : "failed") << endl;
+	}
+
 	void run_tests()
 	{
+		irqs_enable(true);
+
+		test_dma_mapper();
 		test_ATC_load();
 		test_read();
 		test_write();
+		test_copy_fill();
+		test_queue();
 		test_md5();
+
+		irqs_enable(false);
+		sc_stop();
 	}
 
-	void write32(uint32_t addr, uint32_t val)
+	//
+	// Count a failed check, sc_main returns EXIT_FAILURE if any
+	// failed.
+	//
+	void check(bool ok)
+	{
+		if (!ok) {
+			nr_failed++;
+		}
+	}
+
+	void irqs_enable(bool enable)
 	{
-		// only using BAR0
-		uint8_t *map = (uint8_t *) vdev.map[0];
+		if (m_be.has_irqs()) {
+			write32(R_IRQ_ENABLE, enable ?
+				(1 << IRQ_DONE) | (1 << IRQ_QUEUE) : 0);
+		}
+	}
 
-		memcpy_to_io(map + addr, reinterpret_cast<uint8_t*>(&val), sizeof(val));
+	//
+	// Run a register driven operation and wait for it to complete.
+	//
+	// ctrl: the R_CTRL command
+	// iova: the buffer
+	// len: the length of the buffer
+	//
+	// returns: the R_STATUS value
+	//
+	uint32_t run_op(uint32_t ctrl, uint64_t iova, uint32_t len)
+	{
+		write_addr(R_ADDR_LSB, R_ADDR_MSB, iova);
+		write32(R_LENGTH, len);
+		write32(R_STATUS, 0);
+		write32(R_CTRL, ctrl);
+		return wait_for_done();
 	}
 
-	uint32_t read32(uint32_t addr)
+	uint64_t read64(uint32_t lsb, uint32_t msb)
 	{
-		// only using BAR0
-		uint8_t *map = (uint8_t *) vdev.map[0];
-		uint32_t val;
+		uint64_t v = read32(lsb);
+
+		return v | (uint64_t) read32(msb) << 32;
+	}
 
-		memcpy_from_io(reinterpret_cast<uint8_t*>(&val),
-				map + addr, sizeof(val));
+	//
+	// Allocate a benchmark buffer.
+	//
+	// size: the size of the buffer
+	// page_size: the page size backing the buffer, SZ_4K or SZ_2M
+	//            (MAP_HUGETLB)
+	//
+	// returns: the buffer or NULL
+	//
+	uint8_t *bench_alloc(uint64_t size, uint64_t page_size)
+	{
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+		void *m;
 
-		return val;
+		if (page_size == SZ_2M) {
+			flags |= MAP_HUGETLB;
+		}
+
+		m = mmap(0, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (m == MAP_FAILED) {
+			return NULL;
+		}
+
+		// Populate and lock the pages
+		memset(m, 0x5A, size);
+		mlock(m, size);
+
+		return (uint8_t *) m;
 	}
 
+	//
+	// returns: the bytes the ATC holds in translations of page_size
+	//          (see R_ATC_GEOMETRY)
+	//
+	uint64_t atc_reach(uint64_t page_size)
+	{
+		uint32_t geometry = read32(R_ATC_GEOMETRY);
+
+		return (uint64_t) (geometry & 0xFFFF) * (geometry >> 16) *
+			page_size;
+	}
+
+	//
+	// Measure an operation on a buffer and print the result as a CSV
+	// line. Cold measurements remap the buffer before each operation,
+	// which invalidates the ATC, and exclude the remapping from the
+	// time. Warm measurements are limited to the part of the buffer
+	// the ATC can hold, the translations of a larger buffer would
+	// evict each other.
+	//
+	// ctrl: the R_CTRL command measured
+	// buf: the buffer
+	// size: the size of the buffer
+	// page_size: the page size backing the buffer
+	// warm: measure with the translations cached in the ATC
+	//
+	void bench_op(uint32_t ctrl, uint8_t *buf, uint64_t size,
+			uint64_t page_size, bool warm)
+	{
+		chrono::duration<double> wall(0);
+		sc_time sim(SC_ZERO_TIME);
+		unsigned int nr_errors = 0;
+		uint64_t hits, misses, requests;
+		uint64_t iova;
+		double bytes;
+		unsigned int i;
+
+		if (warm && size > atc_reach(page_size)) {
+			size = atc_reach(page_size);
+		}
+
+		if (!m_mapper.map(buf, size, false, &iova, page_size)) {
+			cout << "# out of IOVA space" << endl;
+			return;
+		}
+
+		if (warm) {
+			run_op(R_CTRL_TRANSLATE, iova, size);
+		}
+		write32(R_CTRL, R_CTRL_ATC_STATS_CLEAR);
+
+		for (i = 0; i < m_bench_iters; i++) {
+			chrono::steady_clock::time_point start;
+			sc_time sim_start;
+
+			if (!warm) {
+				m_mapper.unmap(buf, size);
+				m_mapper.flush();
+				if (!m_mapper.map(buf, size, false, &iova,
+							page_size)) {
+					cout << "# out of IOVA space" << endl;
+					return;
+				}
+			}
+
+			start = chrono::steady_clock::now();
+			sim_start = sc_time_stamp();
+
+			if (run_op(ctrl, iova, size) & R_STATUS_ERR) {
+				nr_errors++;
+			}
+
+			wall += chrono::steady_clock::now() - start;
+			sim += sc_time_stamp() - sim_start;
+		}
+
+		hits = read64(R_ATC_HITS_LSB, R_ATC_HITS_MSB);
+		misses = read64(R_ATC_MISSES_LSB, R_ATC_MISSES_MSB);
+		requests = read64(R_ATS_REQUESTS_LSB, R_ATS_REQUESTS_MSB);
+
+		m_mapper.unmap(buf, size);
+		m_mapper.flush();
+
+		//
+		// op,page_size,buf_size,atc,iters,errors,wall_s,sim_s,
+		// wall_MBps,sim_MBps,atc_hits,atc_misses,ats_requests,
+		// wall_translations_per_s,sim_translations_per_s
+		//
+		bytes = (double) size * m_bench_iters;
+		cout << (ctrl == R_CTRL_TRANSLATE ? "translate" : "md5")
+			<< "," << page_size << "," << size
+			<< "," << (warm ? "warm" : "cold")
+			<< "," << m_bench_iters << "," << nr_errors
+			<< "," << wall.count() << "," << sim.to_seconds()
+			<< "," << bytes / wall.count() / 1e6
+			<< "," << bytes / sim.to_seconds() / 1e6
+			<< "," << hits << "," << misses << "," << requests
+			<< "," << requests / wall.count()
+			<< "," << requests / sim.to_seconds() << endl;
+	}
+
+	//
+	// Throughput benchmark: the ATC load and the MD5 operations are
+	// measured for a sweep of buffer sizes, page sizes and with the
+	// ATC warm and cold. The results are printed as CSV, other output
+	// is prefixed with '#'.
+	//
+	void run_bench()
+	{
+		static const uint64_t page_sizes[] = { SZ_4K, SZ_2M };
+		static const uint64_t buf_sizes[] = { SZ_64K, SZ_1M, SZ_16M };
+		static const uint32_t ops[] = {
+			R_CTRL_TRANSLATE,
+			R_CTRL_MD5SUM,
+		};
+		unsigned int p, b, o;
+
+		irqs_enable(true);
+
+		cout << "op,page_size,buf_size,atc,iters,errors,wall_s,sim_s,"
+			"wall_MBps,sim_MBps,atc_hits,atc_misses,ats_requests,"
+			"wall_translations_per_s,sim_translations_per_s"
+			<< endl;
+
+		for (p = 0; p < sizeof(page_sizes) / sizeof(page_sizes[0]);
+			p++) {
+			uint8_t *buf = bench_alloc(SZ_16M, page_sizes[p]);
+
+			if (!buf) {
+				cout << "# no " << page_sizes[p] << " byte pages"
+					<< " available, skipped" << endl;
+				continue;
+			}
+
+			//
+			// The in-process IOMMU translates with the page size
+			// of the buffer, as a host IOMMU would
+			//
+			if (m_loopback) {
+				m_loopback->set_page_size(page_sizes[p]);
+			}
+
+			for (b = 0; b < sizeof(buf_sizes) / sizeof(buf_sizes[0]);
+				b++) {
+				for (o = 0; o < sizeof(ops) / sizeof(ops[0]);
+					o++) {
+					bench_op(ops[o], buf, buf_sizes[b],
+						page_sizes[p], false);
+					bench_op(ops[o], buf, buf_sizes[b],
+						page_sizes[p], true);
+				}
+			}
+
+			munmap(buf, SZ_16M);
+		}
+
+		irqs_enable(false);
+		sc_stop();
+	}
+
+	void write32(uint32_t addr, uint32_t val)
+	{
+		m_be.write32(addr, val);
+	}
+
+	uint32_t read32(uint32_t addr)
+	{
+		return m_be.read32(addr);
+	}
+
+	pcie_acc_backend &m_be;
+	pcie_acc_loopback *m_loopback;
+	vfio_dma_mapper m_mapper;
+
+	// Scratch area
 	uint8_t *m_map;
 	uint64_t m_map_size;
+	uint64_t m_iova;
 
 	const char *m_filename;
+	unsigned int m_bench_iters;
+
+	// Failed test checks
+	unsigned int nr_failed;
 };
 
+static void usage(const char *prog)
+{
+	printf("%s: [options] device-name iommu-group [filename]\n"
+		"%s: [options] -s [filename]\n"
+		"  -s        use an in-process accelerator instead of VFIO\n"
+		"  -b        run the throughput benchmark instead of the tests\n"
+		"  -n iters  operations per benchmark measurement (default 8)\n"
+		"The filename is required when running the tests.\n",
+		prog, prog);
+}
+
 int sc_main(int argc, char *argv[])
 {
+	pcie_acc_loopback *loopback = NULL;
+	const char *filename = NULL;
+	unsigned int bench_iters = 0;
+	unsigned int iters = 8;
+	bool standin = false;
+	bool bench = false;
+	pcie_acc_backend *be;
 	int iommu_group;
+	Top *top;
+	int ret;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sbn:")) != -1) {
+		switch (opt) {
+		case 's':
+			standin = true;
+			break;
+		case 'b':
+			bench = true;
+			break;
+		case 'n':
+			iters = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (bench) {
+		bench_iters = iters ? iters : 1;
+	}
+
+	if (standin) {
+		loopback = new pcie_acc_loopback("standin");
+		be = loopback;
+	} else {
+		if (argc - optind < 2) {
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		iommu_group = strtoull(argv[optind + 1], NULL, 10);
+		be = new pcie_acc_vfio_backend(argv[optind], iommu_group);
+		optind += 2;
+	}
 
-	if (argc < 4) {
-		printf("%s: device-name iommu-group filename\n", argv[0]);
+	if (optind < argc) {
+		filename = argv[optind];
+	} else if (!bench_iters) {
+		usage(argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
-	iommu_group = strtoull(argv[2], NULL, 10);
-	Top top("Top", argv[1], iommu_group, argv[3]);
+	top = new Top("Top", *be, loopback, filename, bench_iters);
 
 	sc_start();
 
-	return 0;
+	ret = top->nr_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+	delete top;
+	delete be;
+	return ret;
 }
@@ -0,0 +1,427 @@
+/*
+ * IOVA allocation and DMA mapping management for the VFIO host
+ * applications of the PCIe accelerator demo.
+ *
+ * Copyright (c) 2021 Xilinx Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __VFIO_DMA_MAPPER_H__
+#define __VFIO_DMA_MAPPER_H__
+
+#include <stdint.h>
+#include <assert.h>
+#include <map>
+#include <utility>
+
+//
+// Something host memory can be mapped for DMA through (the IOMMU).
+//
+class dma_map_backend
+{
+public:
+	virtual ~dma_map_backend() {}
+
+	//
+	// Map / unmap host memory for DMA.
+	//
+	// vaddr: the host virtual address of the buffer
+	// iova: the I/O virtual address the accelerator uses
+	// size: the size of the buffer
+	// write: allow the accelerator to write to the buffer
+	//
+	virtual void map_dma(void *vaddr, uint64_t iova, uint64_t size,
+				bool write) = 0;
+	virtual void unmap_dma(uint64_t iova, uint64_t size) = 0;
+};
+
+//
+// Records the mappings instead of programming an IOMMU, for exercising
+// the mapping management without VFIO. Overlapping IOVA ranges and
+// unmaps not matching a mapping trigger assertions.
+//
+class dma_map_mock : public dma_map_backend
+{
+public:
+	struct Mapping {
+		void *vaddr;
+		uint64_t size;
+		bool write;
+	};
+
+	dma_map_mock() :
+		nr_maps(0),
+		nr_unmaps(0)
+	{}
+
+	void map_dma(void *vaddr, uint64_t iova, uint64_t size, bool write)
+	{
+		std::map<uint64_t, Mapping>::iterator it;
+		Mapping m;
+
+		assert(size);
+
+		it = maps.lower_bound(iova);
+		assert(it == maps.end() || it->first >= iova + size);
+		if (it != maps.begin()) {
+			it--;
+			assert(it->first + it->second.size <= iova);
+		}
+
+		m.vaddr = vaddr;
+		m.size = size;
+		m.write = write;
+		maps[iova] = m;
+		nr_maps++;
+	}
+
+	void unmap_dma(uint64_t iova, uint64_t size)
+	{
+		std::map<uint64_t, Mapping>::iterator it = maps.find(iova);
+
+		assert(it != maps.end() && it->second.size == size);
+		maps.erase(it);
+		nr_unmaps++;
+	}
+
+	// IOVA to mapping
+	std::map<uint64_t, Mapping> maps;
+
+	unsigned int nr_maps;
+	unsigned int nr_unmaps;
+};
+
+//
+// IOVA range allocator (first fit). Allocations are aligned on the
+// requested alignment, freed ranges are merged with their neighbours.
+//
+class iova_allocator
+{
+public:
+	//
+	// base: the start of the IOVA range
+	// size: the size of the IOVA range
+	//
+	iova_allocator(uint64_t base, uint64_t size)
+	{
+		m_free[base] = size;
+	}
+
+	//
+	// Allocate an IOVA range.
+	//
+	// size: the size of the range
+	// align: the alignment of the range (a power of two)
+	// iova: the allocated range start is returned here
+	//
+	// returns: true on success, false if there is no space left
+	//
+	bool alloc(uint64_t size, uint64_t align, uint64_t *iova)
+	{
+		std::map<uint64_t, uint64_t>::iterator it;
+
+		for (it = m_free.begin(); it != m_free.end(); it++) {
+			uint64_t start = (it->first + align - 1) & ~(align - 1);
+			uint64_t end = it->first + it->second;
+
+			if (start < end && end - start >= size) {
+				uint64_t free_start = it->first;
+
+				m_free.erase(it);
+
+				if (start > free_start) {
+					m_free[free_start] = start - free_start;
+				}
+				if (end > start + size) {
+					m_free[start + size] = end - (start + size);
+				}
+
+				*iova = start;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//
+	// Free an IOVA range returned by alloc.
+	//
+	// iova: the start of the range
+	// size: the size of the range
+	//
+	void free(uint64_t iova, uint64_t size)
+	{
+		std::map<uint64_t, uint64_t>::iterator next;
+
+		next = m_free.upper_bound(iova);
+
+		// Merge with the following free range
+		if (next != m_free.end() && iova + size == next->first) {
+			size += next->second;
+			next = m_free.erase(next);
+		}
+
+		// Merge with the preceding free range
+		if (next != m_free.begin()) {
+			std::map<uint64_t, uint64_t>::iterator prev = next;
+
+			prev--;
+			if (prev->first + prev->second == iova) {
+				prev->second += size;
+				return;
+			}
+		}
+
+		m_free[iova] = size;
+	}
+
+private:
+	// Free ranges, start to size
+	std::map<uint64_t, uint64_t> m_free;
+};
+
+//
+// DMA mapping manager. Buffers are mapped on first use at an IOVA taken
+// from an iova_allocator and the mappings are reference counted. A
+// mapping whose last reference is dropped is kept (cached) so that
+// mapping the same buffer again, or a part of it, reuses the IOVA
+// without pinning and mapping the pages another time. The least recently
+// used unreferenced mappings are unmapped once the cached size exceeds
+// 'cache_size'.
+//
+class vfio_dma_mapper
+{
+public:
+	//
+	// backend: what the buffers are mapped through
+	// iova_base: the start of the IOVA range to place the buffers in
+	// iova_size: the size of the IOVA range
+	// cache_size: max bytes kept mapped without references
+	//
+	vfio_dma_mapper(dma_map_backend &backend, uint64_t iova_base,
+			uint64_t iova_size, uint64_t cache_size = 1ULL << 30) :
+		nr_hits(0),
+		nr_misses(0),
+		nr_evictions(0),
+		m_backend(backend),
+		m_iova(iova_base, iova_size),
+		m_cache_size(cache_size),
+		m_cached(0),
+		m_clock(0)
+	{}
+
+	~vfio_dma_mapper()
+	{
+		std::map<Key, Registration>::iterator it;
+
+		for (it = m_regs.begin(); it != m_regs.end(); it++) {
+			m_backend.unmap_dma(it->second.iova, it->first.second);
+		}
+	}
+
+	//
+	// Map a buffer for DMA (or take a reference on an existing
+	// mapping covering it). A write mapping of a buffer covered by a
+	// read-only mapping upgrades that mapping in place.
+	//
+	// vaddr: the host virtual address of the buffer
+	// size: the size of the buffer
+	// write: allow the accelerator to write to the buffer
+	// iova: the IOVA of vaddr is returned here
+	// align: IOVA alignment of new mappings (a power of two), use the
+	//        page size of the buffer to keep its pages translatable as
+	//        a whole
+	//
+	// returns: true on success, false if there is no IOVA space left
+	//
+	bool map(void *vaddr, uint64_t size, bool write, uint64_t *iova,
+			uint64_t align = 4 * 1024)
+	{
+		uintptr_t va = reinterpret_cast<uintptr_t>(vaddr);
+		Registration *r = lookup(va, size);
+		Registration n;
+
+		if (r && write && !r->write) {
+			//
+			// The buffer is mapped read-only, remap the whole
+			// mapping writable at the same IOVA so that references
+			// already taken stay valid.
+			//
+			m_backend.unmap_dma(r->iova, r->size);
+			m_backend.map_dma(reinterpret_cast<void *>(r->vaddr),
+						r->iova, r->size, true);
+			r->write = true;
+			nr_misses++;
+		} else if (r) {
+			nr_hits++;
+		}
+
+		if (r) {
+			if (r->refs++ == 0) {
+				m_cached -= r->size;
+			}
+			r->stamp = ++m_clock;
+			*iova = r->iova + (va - r->vaddr);
+			return true;
+		}
+
+		while (!m_iova.alloc(size, align, &n.iova)) {
+			if (!evict()) {
+				return false;
+			}
+		}
+
+		m_backend.map_dma(vaddr, n.iova, size, write);
+
+		n.vaddr = va;
+		n.size = size;
+		n.write = write;
+		n.refs = 1;
+		n.stamp = ++m_clock;
+		m_regs[Key(va, size)] = n;
+
+		*iova = n.iova;
+		nr_misses++;
+		return true;
+	}
+
+	//
+	// Drop a reference taken by map().
+	//
+	// vaddr: the buffer passed to map()
+	// size: the size passed to map()
+	//
+	void unmap(void *vaddr, uint64_t size)
+	{
+		uintptr_t va = reinterpret_cast<uintptr_t>(vaddr);
+		Registration *r = lookup(va, size);
+
+		assert(r && r->refs);
+
+		if (--r->refs == 0) {
+			m_cached += r->size;
+			while (m_cached > m_cache_size && evict()) {
+				;
+			}
+		}
+	}
+
+	//
+	// Unmap all unreferenced mappings, e.g. before the buffers are
+	// freed.
+	//
+	void flush()
+	{
+		while (evict()) {
+			;
+		}
+	}
+
+	//
+	// Statistics, map() calls served from existing mappings, map()
+	// calls that created mappings and cached mappings unmapped.
+	//
+	unsigned int nr_hits;
+	unsigned int nr_misses;
+	unsigned int nr_evictions;
+
+private:
+	typedef std::pair<uintptr_t, uint64_t> Key;
+
+	struct Registration {
+		uintptr_t vaddr;
+		uint64_t size;
+		uint64_t iova;
+		bool write;
+		unsigned int refs;
+		uint64_t stamp;
+	};
+
+	//
+	// Returns the mapping of the exact buffer or, else, the closest
+	// mapping starting at or below vaddr that covers the buffer. NULL
+	// if there is none.
+	//
+	Registration *lookup(uintptr_t vaddr, uint64_t size)
+	{
+		std::map<Key, Registration>::iterator it;
+
+		it = m_regs.find(Key(vaddr, size));
+		if (it != m_regs.end()) {
+			return &it->second;
+		}
+
+		it = m_regs.upper_bound(Key(vaddr, UINT64_MAX));
+		while (it != m_regs.begin()) {
+			it--;
+
+			if (vaddr - it->second.vaddr < it->second.size &&
+				size <= it->second.size -
+					(vaddr - it->second.vaddr)) {
+				return &it->second;
+			}
+		}
+		return NULL;
+	}
+
+	//
+	// Unmap the least recently used unreferenced mapping.
+	//
+	// returns: false if there was none
+	//
+	bool evict()
+	{
+		std::map<Key, Registration>::iterator victim = m_regs.end();
+		std::map<Key, Registration>::iterator it;
+
+		for (it = m_regs.begin(); it != m_regs.end(); it++) {
+			if (it->second.refs) {
+				continue;
+			}
+			if (victim == m_regs.end() ||
+				it->second.stamp < victim->second.stamp) {
+				victim = it;
+			}
+		}
+
+		if (victim == m_regs.end()) {
+			return false;
+		}
+
+		m_backend.unmap_dma(victim->second.iova, victim->second.size);
+		m_iova.free(victim->second.iova, victim->second.size);
+		m_cached -= victim->second.size;
+		m_regs.erase(victim);
+		nr_evictions++;
+		return true;
+	}
+
+	dma_map_backend &m_backend;
+	iova_allocator m_iova;
+
+	// Buffer (vaddr, size) to mapping
+	std::map<Key, Registration> m_regs;
+
+	uint64_t m_cache_size;
+	uint64_t m_cached;
+	uint64_t m_clock;
+};
+
+#endif /* __VFIO_DMA_MAPPER_H__ */
@@ -0,0 +1,185 @@
+/*
+ * Adaptive sync quantum controller.
+ *
+ * Copyright (c) 2021 Xilinx Inc.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define SC_INCLUDE_DYNAMIC_PROCESSES
+
+#include <inttypes.h>
+#include <map>
+
+#include "systemc.h"
+#include "tlm_utils/simple_initiator_socket.h"
+#include "tlm_utils/simple_target_socket.h"
+#include "tlm_utils/tlm_quantumkeeper.h"
+
+using namespace sc_core;
+using namespace std;
+
+#include "quantum-ctrl.h"
+
+quantum_ctrl::quantum_ctrl(sc_module_name name, sc_time quantum,
+				sc_time min, sc_time max)
+	: sc_module(name), quantum_ns("quantum_ns"),
+	  quantum(quantum), min(min), max(max), nr_activity(0),
+	  last_change(SC_ZERO_TIME), nr_changes(0)
+{
+	/* Start within the bounds.  */
+	if (this->quantum < min) {
+		this->quantum = min;
+	}
+	if (this->quantum > max) {
+		this->quantum = max;
+	}
+
+	tlm_utils::tlm_quantumkeeper::set_global_quantum(this->quantum);
+	quantum_ns.write(this->quantum.value() / sc_time(1, SC_NS).value());
+
+	if (min < max) {
+		SC_THREAD(ctrl_thread);
+	}
+}
+
+void quantum_ctrl::watch_irq(sc_signal_in_if<bool> &sig)
+{
+	sc_spawn_options opts;
+
+	opts.spawn_method();
+	opts.dont_initialize();
+	opts.set_sensitivity(&sig.value_changed_event());
+
+	sc_spawn(sc_bind(&quantum_ctrl::irq_changed, this), 0, &opts);
+}
+
+void quantum_ctrl::irq_changed(void)
+{
+	activity();
+}
+
+void quantum_ctrl::set_quantum(sc_time q)
+{
+	if (q < min) {
+		q = min;
+	}
+	if (q > max) {
+		q = max;
+	}
+	if (q == quantum) {
+		return;
+	}
+
+	time_at[quantum] += sc_time_stamp() - last_change;
+	last_change = sc_time_stamp();
+	nr_changes++;
+
+	quantum = q;
+	tlm_utils::tlm_quantumkeeper::set_global_quantum(quantum);
+	quantum_ns.write(quantum.value() / sc_time(1, SC_NS).value());
+}
+
+/*
+ * Sample the activity once per quantum: shrink after a quantum with
+ * activity, grow after IDLE_QUANTA quanta without.
+ */
+void quantum_ctrl::ctrl_thread(void)
+{
+	unsigned int idle = 0;
+
+	while (true) {
+		uint64_t seen = nr_activity;
+
+		wait(quantum);
+
+		if (nr_activity != seen) {
+			idle = 0;
+			set_quantum(quantum / SHRINK_FACTOR);
+		} else if (++idle >= IDLE_QUANTA) {
+			idle = 0;
+			set_quantum(quantum * 2);
+		}
+	}
+}
+
+void quantum_ctrl::end_of_simulation(void)
+{
+	map<sc_time, sc_time>::iterator it;
+	sc_time total = sc_time_stamp();
+
+	if (!(min < max)) {
+		return;
+	}
+
+	time_at[quantum] += sc_time_stamp() - last_change;
+	last_change = sc_time_stamp();
+
+	cout << name() << ": " << dec << nr_changes
+	     << " quantum changes, time spent per quantum:" << endl;
+	for (it = time_at.begin(); it != time_at.end(); it++) {
+		cout << "  " << it->first << ": " << it->second;
+		if (total > SC_ZERO_TIME) {
+			cout << " (" << 100 * (it->second / total) << "%)";
+		}
+		cout << endl;
+	}
+}
+
+traffic_probe::traffic_probe(sc_module_name name, quantum_ctrl &ctrl)
+	: sc_module(name), tgt_socket("tgt-socket"),
+	  init_socket("init-socket"), ctrl(ctrl)
+{
+	tgt_socket.register_b_transport(this, &traffic_probe::b_transport);
+	tgt_socket.register_transport_dbg(this, &traffic_probe::transport_dbg);
+	tgt_socket.register_get_direct_mem_ptr(this,
+				&traffic_probe::get_direct_mem_ptr);
+	init_socket.register_invalidate_direct_mem_ptr(this,
+				&traffic_probe::invalidate_direct_mem_ptr);
+}
+
+void traffic_probe::b_transport(tlm::tlm_generic_payload& trans,
+				sc_time& delay)
+{
+	ctrl.activity();
+	init_socket->b_transport(trans, delay);
+}
+
+unsigned int traffic_probe::transport_dbg(tlm::tlm_generic_payload& trans)
+{
+	return init_socket->transport_dbg(trans);
+}
+
+/*
+ * Accesses through DMI bypass the probe, the DMI request itself is
+ * accounted as activity.
+ */
+bool traffic_probe::get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+					tlm::tlm_dmi& dmi_data)
+{
+	ctrl.activity();
+	return init_socket->get_direct_mem_ptr(trans, dmi_data);
+}
+
+void traffic_probe::invalidate_direct_mem_ptr(sc_dt::uint64 start,
+						sc_dt::uint64 end)
+{
+	tgt_socket->invalidate_direct_mem_ptr(start, end);
+}
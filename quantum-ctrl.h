@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021 Xilinx Inc.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <map>
+
+/*
+ * Adaptive sync quantum. The quantum is shrunk while there is MMIO, DMA or
+ * IRQ activity between the PS (the remote-port side) and the PL, keeping
+ * the interrupt and MMIO latency low, and grown during idle stretches so
+ * that e.g. booting runs with few synchronizations.
+ *
+ * The activity is reported by traffic_probe modules inserted on the
+ * remote-port memory-mapped links and by watch_irq() on the IRQ wires.
+ * With equal min and max the quantum is fixed and the controller is idle.
+ */
+class quantum_ctrl
+: public sc_core::sc_module
+{
+public:
+	/* The current quantum in ns, for tracing.  */
+	sc_signal<sc_bv<64> > quantum_ns;
+
+	quantum_ctrl(sc_core::sc_module_name name, sc_time quantum,
+			sc_time min, sc_time max);
+	SC_HAS_PROCESS(quantum_ctrl);
+
+	void activity(void) { nr_activity++; }
+	void watch_irq(sc_signal_in_if<bool> &sig);
+
+	void end_of_simulation(void);
+
+private:
+	enum {
+		/* Divide the quantum by this after a quantum with activity.  */
+		SHRINK_FACTOR = 4,
+		/* Double the quantum after this many idle quanta.  */
+		IDLE_QUANTA = 4,
+	};
+
+	sc_time quantum;
+	sc_time min;
+	sc_time max;
+	uint64_t nr_activity;
+
+	/* Report: simulated time spent at each quantum.  */
+	std::map<sc_time, sc_time> time_at;
+	sc_time last_change;
+	unsigned int nr_changes;
+
+	void set_quantum(sc_time q);
+	void ctrl_thread(void);
+	void irq_changed(void);
+};
+
+/*
+ * TLM pass-through that reports the transactions to a quantum_ctrl.
+ */
+class traffic_probe
+: public sc_core::sc_module
+{
+public:
+	tlm_utils::simple_target_socket<traffic_probe> tgt_socket;
+	tlm_utils::simple_initiator_socket<traffic_probe> init_socket;
+
+	traffic_probe(sc_core::sc_module_name name, quantum_ctrl &ctrl);
+
+private:
+	quantum_ctrl &ctrl;
+
+	virtual void b_transport(tlm::tlm_generic_payload& trans,
+					sc_time& delay);
+	virtual unsigned int transport_dbg(tlm::tlm_generic_payload& trans);
+	virtual bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+					tlm::tlm_dmi& dmi_data);
+	virtual void invalidate_direct_mem_ptr(sc_dt::uint64 start,
+					sc_dt::uint64 end);
+};
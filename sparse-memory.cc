@@ -0,0 +1,218 @@
+/*
+ * Sparse memory target.
+ *
+ * Copyright (c) 2021 Xilinx Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define SC_INCLUDE_DYNAMIC_PROCESSES
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "systemc.h"
+#include "tlm_utils/simple_target_socket.h"
+
+using namespace sc_core;
+using namespace std;
+
+#include "sparse-memory.h"
+
+sparse_memory::sparse_memory(sc_module_name name, sc_time latency,
+				uint64_t size)
+	: sc_module(name), socket("socket"), latency(latency), size(size)
+{
+	void *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		perror(sc_module::name());
+		exit(EXIT_FAILURE);
+	}
+	mem = (unsigned char *) p;
+
+	socket.register_b_transport(this, &sparse_memory::b_transport);
+	socket.register_get_direct_mem_ptr(this,
+				&sparse_memory::get_direct_mem_ptr);
+	socket.register_transport_dbg(this, &sparse_memory::transport_dbg);
+}
+
+sparse_memory::~sparse_memory()
+{
+	munmap(mem, size);
+}
+
+bool sparse_memory::map_backing(const char *path)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	if (strncmp(path, "shm:", 4) == 0) {
+		std::string shm_name = std::string("/") + (path + 4);
+
+		fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT, 0600);
+	} else {
+		fd = open(path, O_RDWR | O_CREAT, 0600);
+	}
+	if (fd < 0) {
+		perror(path);
+		return false;
+	}
+
+	if (fstat(fd, &st) || ((uint64_t) st.st_size < size &&
+				ftruncate(fd, size))) {
+		perror(path);
+		close(fd);
+		return false;
+	}
+
+	/* Replace the anonymous mapping in place, mem stays valid.  */
+	p = mmap(mem, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(path);
+		return false;
+	}
+	return true;
+}
+
+uint64_t sparse_memory::resident_size(void)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint64_t nr_pages = (size + page_size - 1) / page_size;
+	unsigned char vec[4096];
+	uint64_t resident = 0;
+	uint64_t i, j;
+
+	/* Query the page residency a chunk at a time.  */
+	for (i = 0; i < nr_pages; i += sizeof vec) {
+		uint64_t n = nr_pages - i < sizeof vec ? nr_pages - i : sizeof vec;
+		uint64_t len = n * page_size;
+
+		if (i * page_size + len > size) {
+			len = size - i * page_size;
+		}
+		if (mincore(mem + i * page_size, len, vec)) {
+			return 0;
+		}
+		for (j = 0; j < n; j++) {
+			resident += vec[j] & 1;
+		}
+	}
+	return resident * page_size;
+}
+
+void sparse_memory::end_of_simulation()
+{
+	printf("%s: %" PRIu64 " of %" PRIu64 " bytes resident\n",
+		name(), resident_size(), size);
+}
+
+void sparse_memory::b_transport(tlm::tlm_generic_payload& trans,
+				sc_time& delay)
+{
+	tlm::tlm_command cmd = trans.get_command();
+	sc_dt::uint64 addr = trans.get_address();
+	unsigned char *data = trans.get_data_ptr();
+	unsigned int len = trans.get_data_length();
+	unsigned char *byt = trans.get_byte_enable_ptr();
+	unsigned int blen = trans.get_byte_enable_length();
+	unsigned int wid = trans.get_streaming_width();
+	unsigned int i;
+
+	if (addr >= size || len > size - addr) {
+		trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
+		return;
+	}
+	if (wid < len) {
+		trans.set_response_status(tlm::TLM_BURST_ERROR_RESPONSE);
+		return;
+	}
+
+	if (cmd == tlm::TLM_READ_COMMAND) {
+		if (byt) {
+			for (i = 0; i < len; i++) {
+				if (byt[i % blen] == TLM_BYTE_ENABLED) {
+					data[i] = mem[addr + i];
+				}
+			}
+		} else {
+			memcpy(data, &mem[addr], len);
+		}
+	} else if (cmd == tlm::TLM_WRITE_COMMAND) {
+		if (byt) {
+			for (i = 0; i < len; i++) {
+				if (byt[i % blen] == TLM_BYTE_ENABLED) {
+					mem[addr + i] = data[i];
+				}
+			}
+		} else {
+			memcpy(&mem[addr], data, len);
+		}
+	}
+
+	delay += latency;
+	trans.set_dmi_allowed(true);
+	trans.set_response_status(tlm::TLM_OK_RESPONSE);
+}
+
+bool sparse_memory::get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+				tlm::tlm_dmi& dmi_data)
+{
+	dmi_data.allow_read_write();
+	dmi_data.set_dmi_ptr(mem);
+	dmi_data.set_start_address(0);
+	dmi_data.set_end_address(size - 1);
+	dmi_data.set_read_latency(latency);
+	dmi_data.set_write_latency(latency);
+	return true;
+}
+
+unsigned int sparse_memory::transport_dbg(tlm::tlm_generic_payload& trans)
+{
+	tlm::tlm_command cmd = trans.get_command();
+	sc_dt::uint64 addr = trans.get_address();
+	unsigned char *data = trans.get_data_ptr();
+	unsigned int len = trans.get_data_length();
+
+	if (addr >= size) {
+		return 0;
+	}
+	if (len > size - addr) {
+		len = size - addr;
+	}
+
+	if (cmd == tlm::TLM_READ_COMMAND) {
+		memcpy(data, &mem[addr], len);
+	} else if (cmd == tlm::TLM_WRITE_COMMAND) {
+		memcpy(&mem[addr], data, len);
+	}
+	return len;
+}
@@ -0,0 +1,78 @@
+/*
+ * Sparse memory target.
+ *
+ * Copyright (c) 2021 Xilinx Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Memory target allocating its storage on demand. The storage is an
+ * anonymous MAP_NORESERVE mapping, the host kernel only backs the pages
+ * the simulation touches (untouched pages read as zero), so creating
+ * large memories neither zero fills them nor charges their full size to
+ * the process RSS.
+ *
+ * A drop-in for the test-modules memory: same constructor and socket.
+ * DMI is offered for the whole memory, a DMI access to an untouched page
+ * allocates it the same way as a b_transport would.
+ *
+ * The memory can instead be backed by a file or a POSIX shared memory
+ * object (map_backing()), mapped shared. Its contents are then preloaded
+ * without copying, visible to host tools while the simulation runs and
+ * can be shared with a QEMU memory-backend-file on the same path.
+ *
+ * The resident size is printed at the end of the simulation.
+ */
+class sparse_memory
+: public sc_core::sc_module
+{
+public:
+	tlm_utils::simple_target_socket<sparse_memory> socket;
+
+	sparse_memory(sc_core::sc_module_name name, sc_time latency,
+			uint64_t size);
+	~sparse_memory();
+
+	/*
+	 * Back the memory by 'path', "shm:<name>" for the POSIX shared
+	 * memory object <name>. The file is created or extended to the
+	 * memory size as needed. Must be called before the simulation
+	 * starts (before DMI pointers have been handed out).
+	 *
+	 * Returns false (keeping the current backing) on errors.
+	 */
+	bool map_backing(const char *path);
+
+	/* Bytes of the memory the host has backed so far.  */
+	uint64_t resident_size(void);
+
+	void end_of_simulation();
+
+private:
+	sc_time latency;
+	uint64_t size;
+	unsigned char *mem;
+
+	virtual void b_transport(tlm::tlm_generic_payload& trans,
+					sc_time& delay);
+	virtual bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+					tlm::tlm_dmi& dmi_data);
+	virtual unsigned int transport_dbg(tlm::tlm_generic_payload& trans);
+};
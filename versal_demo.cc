@@ -45,6 +45,8 @@ using namespace std;
 #include "debugdev.h"
 #include "demo-dma.h"
 #include "xilinx-axidma.h"
+#include "quantum-ctrl.h"
+#include "sparse-memory.h"
 #include "soc/xilinx/versal/xilinx-versal.h"
 
 #include "tlm-bridges/tlm2axilite-bridge.h"
@@ -61,7 +63,7 @@ using namespace std;
 #define MM_TOP_ME       0x200000000ULL
 #define MM_DDR_SIZE     0x80000000ULL
 
-#define NR_MASTERS      6
+#define NR_MASTERS      7
 
 /*
  * Compiling the versal_demo with 'DDR_IN_SYSTEMC=y' will create the lower
@@ -75,6 +77,10 @@ using namespace std;
  * of the DDR (to note is that a mechanism making the cache coherent with other
  * potential masters on the SystemC side is yet to be implemented).
  *
+ * The DDR is a sparse_memory, host memory is only used for the parts of it
+ * the simulation touches. It can be backed by a file or a shared memory
+ * object given as the last argument.
+ *
  * If unsure, do not enable the flag.
  *
  */
@@ -89,9 +95,13 @@ SC_MODULE(Top)
 	SC_HAS_PROCESS(Top);
 	iconnect<NR_MASTERS, NR_DEVICES> *bus;
 	xilinx_versal versal;
+	quantum_ctrl qctrl;
+	traffic_probe fpd_probe;
+	traffic_probe lpd_probe;
+	traffic_probe dma_probe;
 	memory mem;
 #ifdef DDR_IN_SYSTEMC
-	memory *ddr;
+	sparse_memory *ddr;
 #endif
 	memory mem_lpd_rsvd;
 	memory mem_me_tile0;
@@ -207,8 +217,13 @@ SC_MODULE(Top)
 		rst_n.write(!rst.read());
 	}
 
-	Top(sc_module_name name, const char *sk_descr, sc_time quantum) :
+	Top(sc_module_name name, const char *sk_descr, sc_time quantum,
+		sc_time quantum_min, sc_time quantum_max) :
 		versal("versal", sk_descr),
+		qctrl("quantum-ctrl", quantum, quantum_min, quantum_max),
+		fpd_probe("fpd-probe", qctrl),
+		lpd_probe("lpd-probe", qctrl),
+		dma_probe("dma-probe", qctrl),
 		mem("mem", sc_time(1, SC_NS), 64 *1024),
 		mem_lpd_rsvd("mem_lpd_rsvd", sc_time(1, SC_NS), 1024 * 1024),
 		mem_me_tile0("mem_me_tile0", sc_time(1, SC_NS), 32 * 1024),
@@ -306,11 +321,11 @@ SC_MODULE(Top)
 		af_rlast("af_rlast")
 
 	{
+		unsigned int i;
+
 		SC_METHOD(gen_rst_n);
 		sensitive << rst;
 
-		m_qk.set_global_quantum(quantum);
-
 		versal.rst(rst);
 
 		bus   = new iconnect<NR_MASTERS, NR_DEVICES> ("bus");
@@ -351,30 +366,38 @@ SC_MODULE(Top)
 				ADDRMODE_RELATIVE, -1, mem_lpd_rsvd.socket);
 
 #ifdef DDR_IN_SYSTEMC
-		ddr = new memory("ddr", sc_time(1, SC_NS), MM_DDR_SIZE),
+		ddr = new sparse_memory("ddr", sc_time(1, SC_NS), MM_DDR_SIZE),
 
 		bus->memmap(0x0ULL, MM_DDR_SIZE - 1,
 				ADDRMODE_RELATIVE, -1, ddr->socket);
 
 		bus->memmap(MM_DDR_SIZE, 0xffffffff - 1,
-				ADDRMODE_RELATIVE, -1, *(versal.s_axi_fpd));
+				ADDRMODE_RELATIVE, -1, dma_probe.tgt_socket);
 #else
 		bus->memmap(0x0LL, 0xffffffff - 1,
-				ADDRMODE_RELATIVE, -1, *(versal.s_axi_fpd));
+				ADDRMODE_RELATIVE, -1, dma_probe.tgt_socket);
 #endif
+		dma_probe.init_socket.bind(*(versal.s_axi_fpd));
 
-		versal.m_axi_fpd->bind(*(bus->t_sk[0]));
-		versal.m_axi_lpd->bind(*(bus->t_sk[1]));
+		versal.m_axi_fpd->bind(fpd_probe.tgt_socket);
+		fpd_probe.init_socket.bind(*(bus->t_sk[0]));
+		versal.m_axi_lpd->bind(lpd_probe.tgt_socket);
+		lpd_probe.init_socket.bind(*(bus->t_sk[1]));
 		versal.pmc_noc_axi_0->bind(*(bus->t_sk[2]));
 		versal.fpd_cci_noc_0->bind(*(bus->t_sk[3]));
 		versal.noc_lpd_axi_0->bind(*(bus->t_sk[4]));
 
 		dma->init_socket.bind(*(bus->t_sk[5]));
 
+		debug->dma_socket.bind(*(bus->t_sk[6]));
 		debug->irq[0](versal.pl2ps_irq[0]);
 		debug->irq[1](versal.npi_irq[0]);
 		dma->irq(versal.pl2ps_irq[1]);
 
+		for (i = 0; i < versal.pl2ps_irq.size(); i++) {
+			qctrl.watch_irq(versal.pl2ps_irq[i]);
+		}
+
 #ifdef HAVE_VERILOG
 		/* Slow clock to keep simulation fast.  */
 		clk = new sc_clock("clk", sc_time(10, SC_US));
@@ -574,20 +597,23 @@ SC_MODULE(Top)
 
 		versal.tie_off();
 	}
-
-private:
-	tlm_utils::tlm_quantumkeeper m_qk;
 };
 
 void usage(void)
 {
-	cout << "tlm socket-path sync-quantum-ns" << endl;
+	cout << "tlm socket-path sync-quantum-ns "
+		"[quantum-min-ns quantum-max-ns"
+#ifdef DDR_IN_SYSTEMC
+		" [ddr-file|shm:name]"
+#endif
+		"]" << endl;
 }
 
 int sc_main(int argc, char* argv[])
 {
 	Top *top;
 	uint64_t sync_quantum;
+	uint64_t quantum_min, quantum_max;
 
 #if HAVE_VERILOG_VERILATOR
 	Verilated::commandArgs(argc, argv);
@@ -599,9 +625,22 @@ int sc_main(int argc, char* argv[])
 		sync_quantum = strtoull(argv[2], NULL, 10);
 	}
 
+	/* With bounds, the quantum adapts to the PS <-> PL activity.  */
+	quantum_min = quantum_max = sync_quantum;
+	if (argc > 4) {
+		quantum_min = strtoull(argv[3], NULL, 10);
+		quantum_max = strtoull(argv[4], NULL, 10);
+	}
+	if (argc == 4 || quantum_min > quantum_max) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
 	sc_set_time_resolution(1, SC_PS);
 
-	top = new Top("top", argv[1], sc_time((double) sync_quantum, SC_NS));
+	top = new Top("top", argv[1], sc_time((double) sync_quantum, SC_NS),
+			sc_time((double) quantum_min, SC_NS),
+			sc_time((double) quantum_max, SC_NS));
 
 	if (argc < 3) {
 		sc_start(1, SC_PS);
@@ -610,6 +649,16 @@ int sc_main(int argc, char* argv[])
 		exit(EXIT_FAILURE);
 	}
 
+#ifdef DDR_IN_SYSTEMC
+	/*
+	 * Optionally back the DDR by a file or shared memory object, e.g.
+	 * the mem-path of a QEMU memory-backend-file.
+	 */
+	if (argc > 5 && !top->ddr->map_backing(argv[5])) {
+		exit(EXIT_FAILURE);
+	}
+#endif
+
 	/* Pull the reset signal.  */
 	top->rst.write(true);
 	sc_start(1, SC_US);
@@ -617,5 +666,5 @@ int sc_main(int argc, char* argv[])
 
 	sc_start();
 
-	return 0;
+	return debugdev::exit_status();
 }
@@ -26,8 +26,12 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <map>
+#include <utility>
+#include <vector>
 
 #include "systemc.h"
 #include "tlm_utils/simple_initiator_socket.h"
@@ -44,31 +48,80 @@ using namespace std;
 #include "soc/xilinx/versal-net/xilinx-versal-net.h"
 #include "soc/dma/xilinx-cdma.h"
 #include "tlm-extensions/genattr.h"
-#include "memory.h"
+#include "sparse-memory.h"
 
 #define RAM_SIZE (2 * 1024 * 1024)
 
 #define NR_MASTERS	3
 #define NR_DEVICES	7
 
+//
+// A bank of counters usable as hardware semaphores and ticket locks. Each
+// counter has a 0x40 byte register window:
+//
+// 0x00 FETCH_INC (R/W): read returns the value and increments it, write
+//      sets the value.
+// 0x08 VALUE (R/W): plain read / write of the value.
+// 0x10 FETCH_ADD (R/W): read returns the value and adds OPERAND to it,
+//      write adds the written value.
+// 0x18 READ_CLEAR (R): read returns the value and clears it.
+// 0x20 OPERAND (R/W): per master operand of FETCH_ADD and CAS.
+// 0x28 COMPARE (R/W): per master comparand of CAS.
+// 0x30 CAS (R): if the value equals COMPARE it is set to OPERAND. Returns
+//      the old value (the CAS succeeded if it equals COMPARE).
+//
+// Every access completes in a single b_transport call, so operations are
+// atomic with respect to all masters. OPERAND and COMPARE are kept per
+// master (genattr master_id), masters can not clobber each other's.
+//
+// Counters are 64 bits wide. 8 byte accesses operate on all 64 bits,
+// 4 byte accesses on a 32 bit counter (the value wraps at 32 bits and the
+// upper half is cleared).
+//
 class CounterDev : public sc_core::sc_module
 {
 public:
 	enum {
-		R_COUNTER = 0,
+		NR_COUNTERS = 64,
+		COUNTER_STRIDE = 0x40,
 	};
 
+	enum {
+		R_FETCH_INC = 0x00,
+		R_VALUE = 0x08,
+		R_FETCH_ADD = 0x10,
+		R_READ_CLEAR = 0x18,
+		R_OPERAND = 0x20,
+		R_COMPARE = 0x28,
+		R_CAS = 0x30,
+	};
+
+	// Size of the register window
+	static const uint64_t SIZE = NR_COUNTERS * COUNTER_STRIDE;
+
 	tlm_utils::simple_target_socket<CounterDev> tgt_socket;
 
 	CounterDev(sc_core::sc_module_name name) :
 		sc_module(name),
-		tgt_socket("tgt-socket"),
-		r_counter(0)
+		tgt_socket("tgt-socket")
 	{
+		memset(r_counter, 0, sizeof r_counter);
 		tgt_socket.register_b_transport(this, &CounterDev::b_transport);
+		tgt_socket.register_transport_dbg(this,
+					&CounterDev::transport_dbg);
 	}
 
 private:
+	struct MasterRegs {
+		MasterRegs() :
+			operand(0),
+			compare(0)
+		{}
+
+		uint64_t operand;
+		uint64_t compare;
+	};
+
 	virtual void b_transport(tlm::tlm_generic_payload& trans,
 			sc_time& delay)
 	{
@@ -76,30 +129,134 @@ private:
 		unsigned char *data = trans.get_data_ptr();
 		unsigned int len = trans.get_data_length();
 		uint64_t addr = trans.get_address();
-
-		if (len != 4 || trans.get_byte_enable_ptr() ||
-			addr != R_COUNTER) {
+		unsigned int idx = addr / COUNTER_STRIDE;
+		unsigned int reg = addr % COUNTER_STRIDE;
+		uint64_t mask = len == 8 ? UINT64_MAX : UINT32_MAX;
+		uint64_t *counter;
+		MasterRegs *mregs;
+		uint64_t v = 0;
+
+		if ((len != 4 && len != 8) || trans.get_byte_enable_ptr() ||
+			trans.get_streaming_width() < len ||
+			idx >= NR_COUNTERS || reg & 7) {
 			trans.set_response_status(tlm::TLM_GENERIC_ERROR_RESPONSE);
 			return;
 		}
 
-		if (trans.get_command() == tlm::TLM_READ_COMMAND) {
-			memcpy(reinterpret_cast<void*>(data),
-				reinterpret_cast<const void *>(&r_counter),
-				len);
-
-			r_counter++;
+		counter = &r_counter[idx];
+		mregs = &m_master_regs[MasterKey(master_id(trans), idx)];
+
+		if (cmd == tlm::TLM_READ_COMMAND) {
+			v = *counter & mask;
+
+			switch (reg) {
+			case R_FETCH_INC:
+				*counter = (v + 1) & mask;
+				break;
+			case R_FETCH_ADD:
+				*counter = (v + mregs->operand) & mask;
+				break;
+			case R_READ_CLEAR:
+				*counter = 0;
+				break;
+			case R_OPERAND:
+				v = mregs->operand & mask;
+				break;
+			case R_COMPARE:
+				v = mregs->compare & mask;
+				break;
+			case R_CAS:
+				if (v == (mregs->compare & mask)) {
+					*counter = mregs->operand & mask;
+				}
+				break;
+			default:
+				break;
+			}
+
+			memcpy(data, &v, len);
 
 		} else if (cmd == tlm::TLM_WRITE_COMMAND) {
-			memcpy(reinterpret_cast<void*>(&r_counter),
-				reinterpret_cast<const void *>(data),
-				len);
+			memcpy(&v, data, len);
+
+			switch (reg) {
+			case R_FETCH_INC:
+			case R_VALUE:
+				*counter = v;
+				break;
+			case R_FETCH_ADD:
+				*counter = (*counter + v) & mask;
+				break;
+			case R_OPERAND:
+				mregs->operand = v;
+				break;
+			case R_COMPARE:
+				mregs->compare = v;
+				break;
+			default:
+				break;
+			}
 		}
+
+		trans.set_response_status(tlm::TLM_OK_RESPONSE);
 	}
 
-	uint32_t r_counter;
+	//
+	// Debug reads return the counter values without side effects.
+	//
+	virtual unsigned int transport_dbg(tlm::tlm_generic_payload& trans)
+	{
+		unsigned char *data = trans.get_data_ptr();
+		unsigned int len = trans.get_data_length();
+		uint64_t addr = trans.get_address();
+		unsigned int i;
+
+		if (trans.get_command() != tlm::TLM_READ_COMMAND) {
+			return 0;
+		}
+
+		for (i = 0; i < len && addr + i < SIZE; i++) {
+			uint64_t a = addr + i;
+			unsigned int reg = a % COUNTER_STRIDE;
+
+			// FETCH_INC and VALUE read the value, the rest as 0
+			if (reg < R_VALUE + 8) {
+				data[i] = r_counter[a / COUNTER_STRIDE] >>
+						((a & 7) * 8);
+			} else {
+				data[i] = 0;
+			}
+		}
+		return i;
+	}
+
+	uint64_t master_id(tlm::tlm_generic_payload& trans)
+	{
+		genattr_extension *genattr;
+
+		trans.get_extension(genattr);
+		return genattr ? genattr->get_master_id() : 0;
+	}
+
+	typedef std::pair<uint64_t, unsigned int> MasterKey;
+
+	uint64_t r_counter[NR_COUNTERS];
+
+	// Per master and counter OPERAND / COMPARE
+	std::map<MasterKey, MasterRegs> m_master_regs;
 };
 
+//
+// Stamps the SMID on the transactions of a master. Also accounts the
+// master's traffic and optionally shapes it, with a token bucket
+// bandwidth limit and an injected latency, for studying the interference
+// between masters. The limits are applied as annotated delay, the
+// transactions are not blocked in the kernel.
+//
+// Transactions arriving without a genattr extension get one from a pool
+// for the duration of the b_transport call, so the DMA path neither
+// allocates nor leaks an extension per transaction.
+//
 class SMIDdev : public sc_core::sc_module
 {
 public:
@@ -110,20 +267,62 @@ public:
 		sc_module(name),
 		tgt_socket("tgt-socket"),
 		init_socket("init-socket"),
-		m_smid(smid)
+		m_smid(smid),
+		m_rate(0),
+		m_burst(0),
+		m_tokens(0),
+		m_bucket_ts(SC_ZERO_TIME),
+		m_latency(SC_ZERO_TIME),
+		m_throttled(SC_ZERO_TIME),
+		m_injected(SC_ZERO_TIME)
 	{
+		memset(m_nr_trans, 0, sizeof m_nr_trans);
+		memset(m_nr_bytes, 0, sizeof m_nr_bytes);
+
 		tgt_socket.register_b_transport(this, &SMIDdev::b_transport);
 	}
 
+	~SMIDdev()
+	{
+		unsigned int i;
+
+		for (i = 0; i < m_genattr_pool.size(); i++) {
+			delete m_genattr_pool[i];
+		}
+	}
+
+	//
+	// Limit the bandwidth to 'bytes_per_sec' (0 for unlimited), letting
+	// bursts of up to 'burst' bytes through at full speed.
+	//
+	void set_bandwidth(double bytes_per_sec, uint64_t burst = 4096)
+	{
+		m_rate = bytes_per_sec;
+		m_burst = burst;
+		m_tokens = burst;
+	}
+
+	//
+	// Add 'latency' to every transaction.
+	//
+	void set_latency(sc_time latency)
+	{
+		m_latency = latency;
+	}
+
 private:
 	virtual void b_transport(tlm::tlm_generic_payload& trans,
 			sc_time& delay)
 	{
 		genattr_extension *genattr;
+		genattr_extension *pooled = NULL;
+		unsigned int len = trans.get_data_length();
+		bool is_write = trans.get_command() == tlm::TLM_WRITE_COMMAND;
 
 		trans.get_extension(genattr);
 		if (!genattr) {
-			genattr = new genattr_extension();
+			pooled = genattr_get();
+			genattr = pooled;
 			trans.set_extension(genattr);
 		}
 
@@ -132,10 +331,123 @@ private:
 		//
 		genattr->set_master_id(m_smid);
 
+		m_nr_trans[is_write]++;
+		m_nr_bytes[is_write] += len;
+
+		throttle(len, delay);
+		delay += m_latency;
+		m_injected += m_latency;
+
 		init_socket->b_transport(trans, delay);
+
+		if (pooled) {
+			trans.clear_extension(pooled);
+			genattr_put(pooled);
+		}
+	}
+
+	//
+	// The pool holds as many extensions as there have been concurrent
+	// transactions (b_transport may block downstream).
+	//
+	genattr_extension *genattr_get(void)
+	{
+		genattr_extension *genattr;
+
+		if (m_genattr_pool.empty()) {
+			return new genattr_extension();
+		}
+
+		genattr = m_genattr_pool.back();
+		m_genattr_pool.pop_back();
+		return genattr;
+	}
+
+	void genattr_put(genattr_extension *genattr)
+	{
+		// Drop whatever the downstream path may have set
+		*genattr = genattr_extension();
+		m_genattr_pool.push_back(genattr);
+	}
+
+	//
+	// Token bucket, the bucket fills at m_rate up to m_burst bytes. A
+	// transaction larger than the tokens available is delayed until
+	// enough have accumulated.
+	//
+	void throttle(unsigned int len, sc_time& delay)
+	{
+		sc_time now = sc_time_stamp() + delay;
+		double stall;
+
+		if (m_rate <= 0) {
+			return;
+		}
+
+		if (now > m_bucket_ts) {
+			m_tokens += (now - m_bucket_ts).to_seconds() * m_rate;
+			if (m_tokens > m_burst) {
+				m_tokens = m_burst;
+			}
+			m_bucket_ts = now;
+		}
+
+		m_tokens -= len;
+		if (m_tokens < 0) {
+			//
+			// Borrow from the future, the bucket stays empty
+			// until the transaction has been paid for (m_bucket_ts
+			// may already be ahead of now from earlier borrows).
+			//
+			stall = -m_tokens / m_rate;
+			m_tokens = 0;
+			m_bucket_ts += sc_time(stall, SC_SEC);
+			delay += m_bucket_ts - now;
+			m_throttled += m_bucket_ts - now;
+		}
+	}
+
+	void end_of_simulation()
+	{
+		double secs = sc_time_stamp().to_seconds();
+		uint64_t bytes = m_nr_bytes[0] + m_nr_bytes[1];
+
+		printf("%s: SMID 0x%x: reads %" PRIu64 " (%" PRIu64 " bytes), "
+			"writes %" PRIu64 " (%" PRIu64 " bytes), "
+			"%.2f MB/s\n",
+			name(), m_smid,
+			m_nr_trans[0], m_nr_bytes[0],
+			m_nr_trans[1], m_nr_bytes[1],
+			secs > 0 ? bytes / secs / 1e6 : 0);
+		printf("%s: SMID 0x%x: limit %.2f MB/s (burst %" PRIu64
+			" bytes), throttled %s, latency %s injected %s\n",
+			name(), m_smid,
+			m_rate / 1e6, m_burst,
+			m_throttled.to_string().c_str(),
+			m_latency.to_string().c_str(),
+			m_injected.to_string().c_str());
 	}
 
 	uint32_t m_smid;
+
+	// Indexed by is_write
+	uint64_t m_nr_trans[2];
+	uint64_t m_nr_bytes[2];
+
+	// Token bucket, bytes per second, max and current tokens
+	double m_rate;
+	uint64_t m_burst;
+	double m_tokens;
+	// The time m_tokens was valid at
+	sc_time m_bucket_ts;
+
+	sc_time m_latency;
+
+	// Delay added by the bandwidth limit and the latency injection
+	sc_time m_throttled;
+	sc_time m_injected;
+
+	std::vector<genattr_extension *> m_genattr_pool;
 };
 
 SC_MODULE(Top)
@@ -144,8 +456,8 @@ SC_MODULE(Top)
 	xilinx_versal_net versal_net;
 	debugdev debugdev_cpm;
 
-	memory mem0;
-	memory mem1;
+	sparse_memory mem0;
+	sparse_memory mem1;
 
 	xilinx_cdma cdma0;
 	SMIDdev smid_cdma0;
@@ -204,7 +516,7 @@ SC_MODULE(Top)
 				ADDRMODE_RELATIVE, -1, cdma0.target_socket);
 		bus.memmap(0xe4030000ULL, 0x100 - 1,
 				ADDRMODE_RELATIVE, -1, cdma1.target_socket);
-		bus.memmap(0xe4040000ULL, 0x100 - 1,
+		bus.memmap(0xe4040000ULL, CounterDev::SIZE - 1,
 				ADDRMODE_RELATIVE, -1, counter.tgt_socket);
 		bus.memmap(0xe4100000ULL, RAM_SIZE - 1,
 				ADDRMODE_RELATIVE, -1, mem0.socket);
@@ -245,7 +557,9 @@ private:
 
 void usage(void)
 {
-	cout << "tlm socket-path sync-quantum-ns" << endl;
+	cout << "tlm socket-path sync-quantum-ns "
+		"[cdma0-MBps cdma1-MBps [cdma0-latency-ns cdma1-latency-ns "
+		"[mem0-file [mem1-file]]]]" << endl;
 }
 
 int sc_main(int argc, char* argv[])
@@ -271,6 +585,31 @@ int sc_main(int argc, char* argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/* Optional per SMID bandwidth limits and latencies, 0 to disable.  */
+	if (argc > 4) {
+		top->smid_cdma0.set_bandwidth(strtod(argv[3], NULL) * 1e6);
+		top->smid_cdma1.set_bandwidth(strtod(argv[4], NULL) * 1e6);
+	}
+	if (argc > 6) {
+		top->smid_cdma0.set_latency(sc_time(strtod(argv[5], NULL),
+							SC_NS));
+		top->smid_cdma1.set_latency(sc_time(strtod(argv[6], NULL),
+							SC_NS));
+	}
+
+	/*
+	 * Optionally back the memories by files or shared memory objects
+	 * ("shm:name"), "-" keeps the default backing.
+	 */
+	if (argc > 7 && strcmp(argv[7], "-") &&
+		!top->mem0.map_backing(argv[7])) {
+		exit(EXIT_FAILURE);
+	}
+	if (argc > 8 && strcmp(argv[8], "-") &&
+		!top->mem1.map_backing(argv[8])) {
+		exit(EXIT_FAILURE);
+	}
+
 	trace_fp = sc_create_vcd_trace_file("trace");
 	trace(trace_fp, *top, top->name());
 
@@ -278,5 +617,5 @@ int sc_main(int argc, char* argv[])
 	if (trace_fp) {
 		sc_close_vcd_trace_file(trace_fp);
 	}
-	return 0;
+	return debugdev::exit_status();
 }
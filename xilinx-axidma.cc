@@ -30,6 +30,7 @@
 
 #include "tlm_utils/simple_initiator_socket.h"
 #include "tlm_utils/simple_target_socket.h"
+#include "tlm_utils/tlm_quantumkeeper.h"
 
 using namespace sc_core;
 using namespace std;
@@ -123,12 +124,18 @@ void axidma::update_irqs(void)
 
 void axidma_s2mm::do_dma_copy(void) {}
 
+/*
+ * The bursts are issued on the local time of the quantum keeper, the
+ * thread only yields to the kernel at the quantum boundary and before
+ * signalling completion.
+ */
 void axidma_mm2s::do_dma_copy(void)
 {
+	m_qk.reset();
 	while (1) {
 		unsigned char buf[2 * 1024];
 		uint64_t addr;
-		sc_time delay = SC_ZERO_TIME;
+		sc_time delay = m_qk.get_local_time();
 		unsigned int tlen;
 		bool eop;
 
@@ -150,6 +157,7 @@ void axidma_mm2s::do_dma_copy(void)
 			do_dma_trans(tlm::TLM_READ_COMMAND, buf, addr, tlen, delay);
 		}
 		do_stream_trans(tlm::TLM_WRITE_COMMAND, buf, addr, tlen, eop, delay);
+		m_qk.set(delay);
 
 		addr += tlen;
 		regs.length -= tlen;
@@ -158,9 +166,12 @@ void axidma_mm2s::do_dma_copy(void)
 		regs.addr_msb = addr >> 32;
 
 		if (regs.length == 0) {
+			m_qk.sync();
 			/* If the DMA was running, signal done.  */
 			regs.sr |= AXIDMA_SR_IDLE | AXIDMA_SR_IOC_IRQ;
 			ev_update_irqs.notify();
+		} else if (m_qk.need_sync()) {
+			m_qk.sync();
 		}
 	}
 }
@@ -233,6 +244,9 @@ void axidma_s2mm::s_b_transport(tlm::tlm_generic_payload& trans,
 		/* Put back-pressure.  */
 		D(printf("%s: DMA IS IDLE length=%x\n",
 				name(), regs.length));
+		/* Catch up with the initiator's local time before blocking.  */
+		wait(delay);
+		delay = SC_ZERO_TIME;
 		do {
 			wait(ev_dma_copy);
 		} while (regs.sr & AXIDMA_SR_IDLE);
@@ -262,6 +276,7 @@ void axidma_s2mm::s_b_transport(tlm::tlm_generic_payload& trans,
 		regs.length = length_copied;
 	}
 
-	ev_update_irqs.notify();
+	/* The initiator may run ahead, raise the IRQ at its local time.  */
+	ev_update_irqs.notify(delay);
 	trans.set_response_status(tlm::TLM_OK_RESPONSE);
 }
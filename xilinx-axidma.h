@@ -76,6 +76,9 @@ protected:
 
 	sc_event ev_update_irqs;
 	sc_event ev_dma_copy;
+	// Local time of the mm2s copy thread (temporal decoupling).
+	tlm_utils::tlm_quantumkeeper m_qk;
+
 	virtual void do_dma_copy(void) {};
 	void do_dma_trans(tlm::tlm_command cmd, unsigned char *buf,
 			sc_dt::uint64 addr, sc_dt::uint64 len, sc_time &delay);
@@ -42,6 +42,7 @@ using namespace std;
 #include "trace.h"
 #include "soc/interconnect/iconnect.h"
 #include "debugdev.h"
+#include "quantum-ctrl.h"
 #include "soc/xilinx/zynq/xilinx-zynq.h"
 
 #define NR_MASTERS	1
@@ -51,6 +52,8 @@ SC_MODULE(Top)
 {
 	iconnect<NR_MASTERS, NR_DEVICES> bus;
 	xilinx_zynq zynq;
+	quantum_ctrl qctrl;
+	traffic_probe mmio_probe;
 	debugdev debug;
 	sc_signal<bool> rst;
 
@@ -63,43 +66,50 @@ SC_MODULE(Top)
 		rst.write(false);
 	}
 
-	Top(sc_module_name name, const char *sk_descr, sc_time quantum) :
+	Top(sc_module_name name, const char *sk_descr, sc_time quantum,
+		sc_time quantum_min, sc_time quantum_max) :
 		bus("bus"),
 		zynq("zynq", sk_descr),
+		qctrl("quantum-ctrl", quantum, quantum_min, quantum_max),
+		mmio_probe("mmio-probe", qctrl),
 		debug("debug"),
 		rst("rst")
 	{
-		m_qk.set_global_quantum(quantum);
+		unsigned int i;
 
 		zynq.rst(rst);
 
 		bus.memmap(0x40000000ULL, 0x100 - 1,
 				ADDRMODE_RELATIVE, -1, debug.socket);
 
-		zynq.m_axi_gp[0]->bind(*(bus.t_sk[0]));
+		zynq.m_axi_gp[0]->bind(mmio_probe.tgt_socket);
+		mmio_probe.init_socket.bind(*(bus.t_sk[0]));
 
 		/* Connect the PL irqs to the irq_pl_to_ps wires.  */
 		debug.irq[0](zynq.pl2ps_irq[0]);
 
+		for (i = 0; i < zynq.pl2ps_irq.size(); i++) {
+			qctrl.watch_irq(zynq.pl2ps_irq[i]);
+		}
+
 		/* Tie off any remaining unconnected signals.  */
 		zynq.tie_off();
 
 		SC_THREAD(pull_reset);
 	}
-
-private:
-	tlm_utils::tlm_quantumkeeper m_qk;
 };
 
 void usage(void)
 {
-	cout << "tlm socket-path sync-quantum-ns" << endl;
+	cout << "tlm socket-path sync-quantum-ns "
+		"[quantum-min-ns quantum-max-ns]" << endl;
 }
 
 int sc_main(int argc, char* argv[])
 {
 	Top *top;
 	uint64_t sync_quantum;
+	uint64_t quantum_min, quantum_max;
 	sc_trace_file *trace_fp = NULL;
 
 	if (argc < 3) {
@@ -108,9 +118,22 @@ int sc_main(int argc, char* argv[])
 		sync_quantum = strtoull(argv[2], NULL, 10);
 	}
 
+	/* With bounds, the quantum adapts to the PS <-> PL activity.  */
+	quantum_min = quantum_max = sync_quantum;
+	if (argc > 4) {
+		quantum_min = strtoull(argv[3], NULL, 10);
+		quantum_max = strtoull(argv[4], NULL, 10);
+	}
+	if (argc == 4 || quantum_min > quantum_max) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
 	sc_set_time_resolution(1, SC_PS);
 
-	top = new Top("top", argv[1], sc_time((double) sync_quantum, SC_NS));
+	top = new Top("top", argv[1], sc_time((double) sync_quantum, SC_NS),
+			sc_time((double) quantum_min, SC_NS),
+			sc_time((double) quantum_max, SC_NS));
 
 	if (argc < 3) {
 		sc_start(1, SC_PS);
@@ -126,5 +149,5 @@ int sc_main(int argc, char* argv[])
 	if (trace_fp) {
 		sc_close_vcd_trace_file(trace_fp);
 	}
-	return 0;
+	return debugdev::exit_status();
 }
@@ -44,6 +44,8 @@ using namespace std;
 #include "tests/test-modules/memory.h"
 #include "debugdev.h"
 #include "demo-dma.h"
+#include "quantum-ctrl.h"
+#include "sparse-memory.h"
 #include "soc/xilinx/zynqmp/xilinx-zynqmp.h"
 
 #include "checkers/pc-axilite.h"
@@ -63,7 +65,7 @@ using namespace std;
 #endif
 
 #define NR_DEMODMA      4
-#define NR_MASTERS	1 + NR_DEMODMA
+#define NR_MASTERS	2 + NR_DEMODMA
 #define NR_DEVICES	6 + NR_DEMODMA
 
 SC_MODULE(Top)
@@ -71,7 +73,10 @@ SC_MODULE(Top)
 	SC_HAS_PROCESS(Top);
 	iconnect<NR_MASTERS, NR_DEVICES> bus;
 	xilinx_zynqmp zynq;
-	memory mem;
+	quantum_ctrl qctrl;
+	traffic_probe mmio_probe;
+	traffic_probe dma_probe;
+	sparse_memory mem;
 	debugdev debug;
 	demodma *dma[NR_DEMODMA];
 
@@ -202,9 +207,13 @@ SC_MODULE(Top)
 		return cfg;
 	}
 
-	Top(sc_module_name name, const char *sk_descr, sc_time quantum) :
+	Top(sc_module_name name, const char *sk_descr, sc_time quantum,
+		sc_time quantum_min, sc_time quantum_max) :
 		bus("bus"),
 		zynq("zynq", sk_descr),
+		qctrl("quantum-ctrl", quantum, quantum_min, quantum_max),
+		mmio_probe("mmio-probe", qctrl),
+		dma_probe("dma-probe", qctrl),
 		mem("mem", sc_time(1, SC_NS), 64 * 1024),
 		debug("debug"),
 		rst("rst"),
@@ -305,8 +314,6 @@ SC_MODULE(Top)
 		SC_METHOD(gen_rst_n);
 		sensitive << rst;
 
-		m_qk.set_global_quantum(quantum);
-
 		zynq.rst(rst);
 
 		for (i = 0; i < (sizeof dma / sizeof dma[0]); i++) {
@@ -345,17 +352,24 @@ SC_MODULE(Top)
 				ADDRMODE_RELATIVE, -1, mem.socket);
 
 		bus.memmap(0x0LL, 0xffffffff - 1,
-				ADDRMODE_RELATIVE, -1, *(zynq.s_axi_hpc_fpd[0]));
+				ADDRMODE_RELATIVE, -1, dma_probe.tgt_socket);
+		dma_probe.init_socket.bind(*(zynq.s_axi_hpc_fpd[0]));
 
-		zynq.s_axi_hpm_fpd[0]->bind(*(bus.t_sk[0]));
+		zynq.s_axi_hpm_fpd[0]->bind(mmio_probe.tgt_socket);
+		mmio_probe.init_socket.bind(*(bus.t_sk[0]));
 
 		for (i = 0; i < (sizeof dma / sizeof dma[0]); i++) {
 			dma[i]->init_socket.bind(*(bus.t_sk[1 + i]));
 			dma[i]->irq(zynq.pl2ps_irq[1 + i]);
 		}
 
+		debug.dma_socket.bind(*(bus.t_sk[1 + NR_DEMODMA]));
 		debug.irq[0](zynq.pl2ps_irq[0]);
 
+		for (i = 0; i < zynq.pl2ps_irq.size(); i++) {
+			qctrl.watch_irq(zynq.pl2ps_irq[i]);
+		}
+
 #ifdef HAVE_VERILOG
 		/* Slow clock to keep simulation fast.  */
 		clk = new sc_clock("clk", sc_time(10, SC_US));
@@ -584,20 +598,19 @@ SC_MODULE(Top)
 
 		SC_THREAD(pull_reset);
 	}
-
-private:
-	tlm_utils::tlm_quantumkeeper m_qk;
 };
 
 void usage(void)
 {
-	cout << "tlm socket-path sync-quantum-ns" << endl;
+	cout << "tlm socket-path sync-quantum-ns "
+		"[quantum-min-ns quantum-max-ns]" << endl;
 }
 
 int sc_main(int argc, char* argv[])
 {
 	Top *top;
 	uint64_t sync_quantum;
+	uint64_t quantum_min, quantum_max;
 	sc_trace_file *trace_fp = NULL;
 
 #if HAVE_VERILOG_VERILATOR
@@ -610,9 +623,22 @@ int sc_main(int argc, char* argv[])
 		sync_quantum = strtoull(argv[2], NULL, 10);
 	}
 
+	/* With bounds, the quantum adapts to the PS <-> PL activity.  */
+	quantum_min = quantum_max = sync_quantum;
+	if (argc > 4) {
+		quantum_min = strtoull(argv[3], NULL, 10);
+		quantum_max = strtoull(argv[4], NULL, 10);
+	}
+	if (argc == 4 || quantum_min > quantum_max) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
 	sc_set_time_resolution(1, SC_PS);
 
-	top = new Top("top", argv[1], sc_time((double) sync_quantum, SC_NS));
+	top = new Top("top", argv[1], sc_time((double) sync_quantum, SC_NS),
+			sc_time((double) quantum_min, SC_NS),
+			sc_time((double) quantum_max, SC_NS));
 
 	if (argc < 3) {
 		sc_start(1, SC_PS);
@@ -647,5 +673,5 @@ int sc_main(int argc, char* argv[])
 #if defined(HAVE_VERILOG_VERILATOR) && VM_TRACE
         if (tfp) { tfp->close(); tfp = NULL; }
 #endif
-	return 0;
+	return debugdev::exit_status();
 }
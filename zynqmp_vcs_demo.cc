@@ -343,5 +343,5 @@ int sc_main(int argc, char* argv[])
 	printf("formal starting the design\n");
 	sc_start(10000000, SC_SEC);
 	sc_stop();
-	return 0;
+	return debugdev::exit_status();
 }